@@ -27,6 +27,7 @@ SOURCES += \
     inc/json/json_value.cpp \
     inc/json/json_writer.cpp \
     src/chess/base.cpp \
+    src/chess/bitboard.cpp \
     src/chess/chessboard.cpp \
     src/chess/chessboardvs.cpp \
     src/dialog/chessonline.cpp \
@@ -39,6 +40,8 @@ SOURCES += \
     src/mainwindow.cpp \
     src/network/api.cpp \
     src/network/client.cpp \
+    src/network/frame.cpp \
+    src/network/framedecoder.cpp \
     src/widget/chathistory.cpp \
     src/widget/chatinput.cpp \
     src/widget/imagecropperlabel.cpp
@@ -58,6 +61,7 @@ HEADERS += \
     inc/json/json_tool.h \
     inc/json/json_valueiterator.inl \
     src/chess/base.h \
+    src/chess/bitboard.h \
     src/chess/chessboard.h \
     src/chess/chessboardvs.h \
     src/chess/player.h \
@@ -71,6 +75,8 @@ HEADERS += \
     src/mainwindow.h \
     src/network/api.h \
     src/network/client.h \
+    src/network/frame.h \
+    src/network/framedecoder.h \
     src/widget/chathistory.h \
     src/widget/chatinput.h \
     src/widget/imagecropperlabel.h
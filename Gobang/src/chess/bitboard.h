@@ -0,0 +1,58 @@
+#ifndef BITBOARD_H
+#define BITBOARD_H
+
+#include <stdint.h>
+
+#include "base.h"
+
+// Packed board shared with the server.
+// Each colour is a bit set with one 16-bit lane per row; the 16th bit of a
+// lane is always empty so horizontal shifts never bleed into the next row.
+// 15 rows take 240 bits, stored in 4 uint64 words. Five-in-a-row checks are
+// done with shifts and ANDs over whole words instead of walking cells.
+class BitBoard
+{
+public:
+    enum { SIZE = 15, STRIDE = 16, WORDS = 4 };
+
+    // Bit index step for one cell along each direction
+    enum Direction {
+        DIR_ROW = 1,            // horizontal
+        DIR_COL = STRIDE,       // vertical
+        DIR_DIAG = STRIDE + 1,  // top-left -> bottom-right
+        DIR_ANTI = STRIDE - 1   // top-right -> bottom-left
+    };
+
+    BitBoard() { clear(); }
+
+public:
+    void clear();
+
+    ChessType get(int row, int col) const;
+    void set(int row, int col, ChessType type);     // CHESS_NULL clears the cell
+    bool isEmpty(int row, int col) const { return !((black[word(row, col)] | white[word(row, col)]) & mask(row, col)); }
+    int count() const;                              // number of pieces on the board
+
+    // Pieces of one colour along a line, bit i is the i-th cell of the line.
+    // index receives the position of (row, col) on that line.
+    uint16_t rowBits(ChessType type, int row) const;
+    uint16_t colBits(ChessType type, int col) const;
+    uint16_t lineBits(ChessType type, int row, int col, Direction dir, int& index) const;
+
+    bool hasFiveAt(int row, int col, ChessType type) const;     // a five passing through (row, col)
+    bool hasFive(ChessType type) const;                         // a five anywhere on the board
+
+private:
+    static int bit(int row, int col) { return row * STRIDE + col; }
+    static int word(int row, int col) { return bit(row, col) >> 6; }
+    static uint64_t mask(int row, int col) { return uint64_t(1) << (bit(row, col) & 63); }
+    static void shiftDown(const uint64_t* in, int shift, uint64_t* out);   // shift all 240 bits right
+
+    const uint64_t* side(ChessType type) const { return type == CHESS_BLACK ? black : white; }
+
+private:
+    uint64_t black[WORDS];
+    uint64_t white[WORDS];
+};
+
+#endif // BITBOARD_H
@@ -21,25 +21,27 @@ ChessBoard::ChessBoard(QWidget *parent) :
 }
 
 void ChessBoard::init() {
-    numPieces = 0;
     lastPiece = { 0, 0, CHESS_NULL };
-    for (int row = 0; row < ROWS; ++row) {
-        for (int col = 0; col < ROWS; ++col) {
-            chessPieces[row][col] = CHESS_NULL;
-        }
-    }
+    board.clear();
     drawChessboard();
 }
 
-void ChessBoard::init(int pieces[][ROWS], ChessPieceInfo lastPieceInfo) {
-    numPieces = 0;
+void ChessBoard::init(const BitBoard& pieces, ChessPieceInfo lastPieceInfo) {
     lastPiece = lastPieceInfo;
-    for (int row = 0; row < ROWS; ++row) {
-        for (int col = 0; col < ROWS; ++col) {
-            chessPieces[row][col] = pieces[row][col];
-            if (chessPieces[row][col] != CHESS_NULL)
-                numPieces++;
-        }
+    board = pieces;
+    flush();
+}
+
+void ChessBoard::replay(const std::vector<int>& moves) {
+    board.clear();
+    lastPiece = { 0, 0, CHESS_NULL };
+    ChessType type = CHESS_BLACK;
+    for (int move : moves) {
+        if (move < 0 || move >= ROWS * ROWS)
+            continue;
+        board.set(move / ROWS, move % ROWS, type);
+        lastPiece = { move / ROWS, move % ROWS, type };
+        type = reverse(type);
     }
     flush();
 }
@@ -49,7 +51,7 @@ void ChessBoard::flush() {
 
     for (int row = 0; row < ROWS; ++row) {
         for (int col = 0; col < ROWS; ++col) {
-            drawPiece(row, col, ChessType(chessPieces[row][col]), false);
+            drawPiece(row, col, board.get(row, col), false);
         }
     }
 
@@ -115,7 +117,7 @@ void ChessBoard::drawChessboard() {
 
 // Place a piece
 void ChessBoard::setPiece(int row, int col, ChessType type) {
-    chessPieces[row][col] = type;
+    board.set(row, col, type);
 
     drawPiece(lastPiece.row, lastPiece.col, lastPiece.type, false);
     drawPiece(row, col, type, true);
@@ -134,7 +136,7 @@ void ChessBoard::setPiece(int row, int col, ChessType type) {
 
 bool ChessBoard::isValid(int row, int col) {
     return (row >= 0 && row < ROWS && col >= 0 && col < ROWS &&
-            chessPieces[row][col] == CHESS_NULL);
+            board.isEmpty(row, col));
 }
 
 bool ChessBoard::getRowCol(QPoint cursorPos, int &row, int &col) {
@@ -262,155 +264,13 @@ void ChessBoard::drawPiece(int row, int col, ChessType type, bool highlight) {
 
     painter.end();
     imgLabel->setPixmap(pixmap);
-    numPieces++;
 }
 
 int ChessBoard::judge(int row, int col) {
-    int chessType = chessPieces[row][col];
-
-    bool ret= (judgeInRow(row, col, chessType) ||
-               judgeInCol(row, col, chessType) ||
-               judgeFromTopleftToBottomRight(row, col, chessType) ||
-               judgeFromBottomleftToTopright(row, col, chessType)
-              );
-
-    if (ret)
+    if (board.hasFiveAt(row, col, board.get(row, col)))
         return S_WIN;
-    if (numPieces == ROWS * ROWS)
+    if (board.count() == ROWS * ROWS)
         return S_DRAW;
     else
         return S_CONTINUE;
 }
-
-//int ChessBoard::judge() {
-//
-//    return 0;
-//}
-
-// Five in row
-bool ChessBoard::judgeInRow(int row, int col, int chessType) {
-    int count = 1;
-    int l = col - 1, r = col + 1;
-    while (l > -1 || r < ROWS) {
-        if (l > -1) {
-            if (chessPieces[row][l] == chessType) {
-                count++;
-                l--;
-            }
-            else {
-                l = -1;
-            }
-        }
-        if (r < ROWS) {
-            if (chessPieces[row][r] == chessType) {
-                count++;
-                r++;
-            }
-            else {
-                r = ROWS;
-            }
-        }
-    }
-
-    return count >= 5;
-}
-
-// Five in column
-bool ChessBoard::judgeInCol(int row, int col, int chessType) {
-    int count = 1;
-    int t = row - 1, b = row + 1;
-    while (t > -1 || b < ROWS) {
-        if (t > -1) {
-            if (chessPieces[t][col] == chessType) {
-                count++;
-                t--;
-            }
-            else {
-                t = -1;
-            }
-        }
-        if (b < ROWS) {
-            if (chessPieces[b][col] == chessType) {
-                count++;
-                b++;
-            }
-            else {
-                b = ROWS;
-            }
-        }
-    }
-
-    return count >= 5;
-}
-
-// topLeft -> bottomRight
-bool ChessBoard::judgeFromTopleftToBottomRight(int row, int col, int chessType) {
-    int count = 1;
-    int l = col - 1, r = col + 1;
-    int t = row - 1, b = row + 1;
-    bool bTL = (t > -1 && l > -1);
-    bool bBR = (b < ROWS && r < ROWS);
-
-    while (bTL || bBR) {
-        if (bTL) {
-            if (chessPieces[t][l] == chessType) {
-                count++;
-                t--;
-                l--;
-            }
-            else {
-                t = -1;
-            }
-        }
-        if (bBR) {
-            if (chessPieces[b][r] == chessType) {
-                count++;
-                b++;
-                r++;
-            }
-            else {
-                b = ROWS;
-            }
-        }
-        bTL = (t > -1 && l > -1);
-        bBR = (b < ROWS && r < ROWS);
-    }
-
-    return count >= 5;
-}
-
-// bottomLeft -> topRight
-bool ChessBoard::judgeFromBottomleftToTopright(int row, int col, int chessType) {
-    int count = 1;
-    int l = col - 1, r = col + 1;
-    int t = row - 1, b = row + 1;
-    bool bBL = (b > -1 && l > -1);
-    bool bTR = (t < ROWS && r < ROWS);
-
-    while (bBL || bTR) {
-        if (bBL) {
-            if (chessPieces[b][l] == chessType) {
-                count++;
-                b++;
-                l--;
-            }
-            else {
-                b = -1;
-            }
-        }
-        if (bTR) {
-            if (chessPieces[t][r] == chessType) {
-                count++;
-                t--;
-                r++;
-            }
-            else {
-                t = ROWS;
-            }
-        }
-        bBL = (b > -1 && l > -1);
-        bTR = (t < ROWS && r < ROWS);
-    }
-
-    return count >= 5;
-}
@@ -5,7 +5,10 @@
 #include <QLabel>
 #include <QColor>
 
+#include <vector>
+
 #include "base.h"
+#include "bitboard.h"
 #include "../environment.h"
 
 class ChessBoard : public QWidget
@@ -26,7 +29,9 @@ public:
     // clear all pieces
     void init();
     // or fill chessboard with specical pieces
-    void init(int pieces[][ROWS], ChessPieceInfo lastPieceType);
+    void init(const BitBoard& pieces, ChessPieceInfo lastPieceType);
+    // or replay the moves in order (row*15+col each, black first), without judging
+    void replay(const std::vector<int>& moves);
 
     // not clear pieces, just repaint
     void flush();
@@ -63,18 +68,12 @@ protected:
     bool isValid(int row, int col);
     bool getRowCol(QPoint cursorPos, int& row, int& col);
 
-    //int judge();
     int judge(int row, int col);
-    bool judgeInRow(int row, int col, int chessType);
-    bool judgeInCol(int row, int col, int chessType);
-    bool judgeFromTopleftToBottomRight(int row, int col, int chessType);
-    bool judgeFromBottomleftToTopright(int row, int col, int chessType);
 
 protected:
 
     // Chess pieces
-    int chessPieces[ROWS][ROWS];
-    int numPieces = 0;
+    BitBoard board;
 
     const int gridWidth = 40;
     const int startX = 27;
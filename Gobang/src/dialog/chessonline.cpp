@@ -585,6 +585,21 @@ void ChessOnline::processMsgTypeNotify(const Json::Value &root) {
         chessBoard->setPiece(row, col);
         changeTurn();
     }
+    else if (sub_type == "game_over") {
+        // Wins and draws are detected locally, only a move timeout is decided by the server
+        if (root["reason"].asString() != "timeout" || gameStatus != GAME_RUNNING)
+            return;
+        QString text = root["chess_type"].asInt() == playerYou->getType() ?
+                    "The rival ran out of time. You won!" : "You ran out of time. You lose!";
+        chatHistory->addNewChat("System", "Game over! " + text, Qt::red);
+        QMessageBox::information(this, "Game Over", text, QMessageBox::Ok);
+        gameOver();
+    }
+    else if (sub_type == "server_shutdown") {
+        gameStatus = GAME_END;
+        btnStart->setText("Start");
+        chatHistory->addNewChat("System", "The server is shutting down.", Qt::red);
+    }
     else if (sub_type == "disconnect") {
         labelRivalTurn->setPixmap(rivalDisconnect);
         gameStatus = GAME_END;
@@ -40,12 +40,12 @@ void JoinRoomDialog::setupLayout() {
     editServerIp = new QLineEdit(this);
     editServerPort = new QLineEdit(this);
     editYourName = new QLineEdit(this);
-    editRoomId->setValidator(new QIntValidator(1000, 9999, this));
+    editRoomId->setValidator(new QIntValidator(1000, 999999, this));
     editRoomId->setFocus();
 
     QHBoxLayout* roomIdLayout = new QHBoxLayout();
     roomIdLayout->addWidget(editRoomId);
-    roomIdLayout->addWidget(new QLabel("(1000 ~ 9999)", this));
+    roomIdLayout->addWidget(new QLabel("(1000 ~ 999999)", this));
 
     QHBoxLayout* serverInfoLayout = new QHBoxLayout();
     serverInfoLayout->addWidget(editServerIp, 3);
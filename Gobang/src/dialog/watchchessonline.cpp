@@ -265,6 +265,18 @@ void WatchChessOnline::gameOver() {
     labelPlayer2Turn->setPixmap(sameColorWithBg);
 }
 
+// Whoever did not play the last piece is to move
+void WatchChessOnline::showTurnAfter(ChessType type) {
+    if (type == player1.getType()) {
+        labelPlayer1Turn->setPixmap(sameColorWithBg);
+        labelPlayer2Turn->setPixmap(*player2Chess);
+    }
+    else {
+        labelPlayer1Turn->setPixmap(*player1Chess);
+        labelPlayer2Turn->setPixmap(sameColorWithBg);
+    }
+}
+
 
 /**************************************************************
  *
@@ -392,10 +404,10 @@ void WatchChessOnline::processMsgTypeNotify(const Json::Value &root) {
         Json::Value lastPiece = root["last_piece"];
         if (layout.isNull() || !layout.isArray())
             return;
-        int pieces[15][15];
-        for (int row = 0; row < 15; ++row) {
-            for (int col = 0; col < 15; ++col) {
-                pieces[row][col] = layout[row * 15 + col].asInt();
+        BitBoard pieces;
+        for (int row = 0; row < BitBoard::SIZE; ++row) {
+            for (int col = 0; col < BitBoard::SIZE; ++col) {
+                pieces.set(row, col, ChessType(layout[row * BitBoard::SIZE + col].asInt()));
             }
         }
         int row = lastPiece["row"].asInt();
@@ -405,6 +417,17 @@ void WatchChessOnline::processMsgTypeNotify(const Json::Value &root) {
         if (type == CHESS_NULL)
             return;
     }
+    else if (sub_type == "move_list") {
+        const Json::Value& list = root["moves"];
+        if (!list.isArray())
+            return;
+        std::vector<int> moves;
+        for (const Json::Value& move : list)
+            moves.push_back(move.asInt());
+        chessBoard->replay(moves);
+        if (!moves.empty())
+            showTurnAfter(moves.size() % 2 ? CHESS_BLACK : CHESS_WHITE);
+    }
     else if (sub_type == "game_start") {
         chessBoard->init();
 
@@ -455,14 +478,10 @@ void WatchChessOnline::processMsgTypeNotify(const Json::Value &root) {
         int col = root["col"].asInt();
         int type = root["chess_type"].asInt();
         chessBoard->setPiece(row, col, ChessType(type));
-        if (type == player1.getType()) {
-            labelPlayer1Turn->setPixmap(sameColorWithBg);
-            labelPlayer2Turn->setPixmap(*player2Chess);
-        }
-        else {
-            labelPlayer1Turn->setPixmap(*player1Chess);
-            labelPlayer2Turn->setPixmap(sameColorWithBg);
-        }
+        showTurnAfter(ChessType(type));
+    }
+    else if (sub_type == "server_shutdown") {
+        chatHistory->addNewChat("System", "The server is shutting down.", Qt::red);
     }
     else if (sub_type == "disconnect") {
         if (root["player_name"].isNull())
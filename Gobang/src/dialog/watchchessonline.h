@@ -56,6 +56,7 @@ private:
     void startRecvMsg();
     void exchangeChessType();
     void gameOver();
+    void showTurnAfter(ChessType type);
 
     /*******************************
      * Parse and process recv msg
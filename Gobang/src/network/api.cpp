@@ -37,6 +37,8 @@ bool createRoom(Client* client, const QString& room_name, const QString& your_na
     Json::Value root;
     root["type"] = "command";
     root["cmd"] = "create_room";
+    root["framing"] = "binary";     // ask for binary framing, old servers ignore it
+    root["heartbeat"] = true;       // servers that understand pings answer with a pong
     root["room_name"] = room_name.toStdString();
     root["player_name"] = your_name.toStdString();
     return client->sendJsonMsg(root);
@@ -46,6 +48,8 @@ bool joinRoom(Client* client, int room_id, const QString& your_name) {
     Json::Value root;
     root["type"] = "command";
     root["cmd"] = "join_room";
+    root["framing"] = "binary";     // ask for binary framing, old servers ignore it
+    root["heartbeat"] = true;       // servers that understand pings answer with a pong
     root["room_id"] = room_id;
     root["player_name"] = your_name.toStdString();
     return client->sendJsonMsg(root);
@@ -55,6 +59,9 @@ bool watchRoom(Client* client, int room_id, const QString& your_name) {
     Json::Value root;
     root["type"] = "command";
     root["cmd"] = "watch_room";
+    root["framing"] = "binary";     // ask for binary framing, old servers ignore it
+    root["heartbeat"] = true;       // servers that understand pings answer with a pong
+    root["move_list"] = true;       // catch up from the move list instead of the whole board
     root["room_id"] = room_id;
     root["player_name"] = your_name.toStdString();
     return client->sendJsonMsg(root);
@@ -96,6 +103,13 @@ bool responseExchageChessType(Client* client, bool yesOrNo) {
  * Type: Notify
 *************************/
 bool notifyNewPiece(Client* client, int row, int col, int chess_type) {
+    // 2-byte move message once binary framing is in use
+    if (client->getFraming() == FRAMING_BINARY) {
+        char body[MOVE_BODY_LENGTH];
+        encodeMove(body, row, col, chess_type);
+        return client->sendFrame(FRAME_MOVE, body, MOVE_BODY_LENGTH);
+    }
+
     Json::Value root;
     root["type"] = "notify";
     root["sub_type"] = "new_piece";
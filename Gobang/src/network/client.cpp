@@ -17,8 +17,16 @@
     #include <sys/socket.h>
 #endif
 
+// A heartbeat to a vanished server must fail with an error, not kill the process with SIGPIPE
+#ifdef MSG_NOSIGNAL
+    #define SEND_FLAGS MSG_NOSIGNAL
+#else
+    #define SEND_FLAGS 0
+#endif
+
 
 Client::~Client() {
+    stopHeartbeat();
 }
 
 // Just for win32
@@ -32,6 +40,7 @@ bool Client::InitNetwork() {
 }
 
 void Client::disconnect() {
+    stopHeartbeat();
     if (socketfd > 0) {
         //this->closesocket();
         shutdown(socketfd, 2);
@@ -65,9 +74,53 @@ bool Client::connectServer(const char* servAddrStr, int port) {
 
     serverIp = servAddrStr;
     serverPort = port;
+    decoder.clear();
+    framing = FRAMING_TEXT;
+    heartbeatSupported = false;
+    startHeartbeat(HEARTBEAT_INTERVAL_MS, HEARTBEAT_MISS_COUNT);
     return true;
 }
 
+void Client::startHeartbeat(int intervalMs, int missCount) {
+    stopHeartbeat();
+
+    // Wake up the receiving thread once per interval to check the deadline
+#ifdef WIN32
+    DWORD timeout = intervalMs;
+#else
+    struct timeval timeout = { intervalMs / 1000, (intervalMs % 1000) * 1000 };
+#endif
+    setsockopt(socketfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+
+    heartbeatIntervalMs = intervalMs;
+    heartbeatMissCount = missCount;
+    lastReceived = std::chrono::steady_clock::now();
+    heartbeatStop = false;
+    heartbeatThread = std::thread([this, intervalMs](){
+        std::unique_lock<std::mutex> lock(heartbeatMutex);
+        while (!heartbeatCond.wait_for(lock, std::chrono::milliseconds(intervalMs),
+                                       [this](){ return heartbeatStop; })) {
+            // An older server would take the ping for a broken header
+            if (!heartbeatSupported)
+                continue;
+            if (!sendFrame(FRAME_PING, nullptr, 0))
+                break;
+        }
+    });
+}
+
+void Client::stopHeartbeat() {
+    if (!heartbeatThread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(heartbeatMutex);
+        heartbeatStop = true;
+    }
+    heartbeatCond.notify_all();
+    heartbeatThread.join();
+    heartbeatIntervalMs = 0;
+}
+
 bool Client::sendJsonMsg(const Json::Value &json) {
     return sendJsonMsg(Json::FastWriter().write(json));
 }
@@ -76,79 +129,106 @@ bool Client::sendJsonMsg(const std::string& msg) {
     if (msg.empty())
         return false;
 
-    int len = msg.length();
-    std::string msgSend;
-    msgSend.reserve(12 + len);
-    msgSend += "length:";
-    msgSend += std::to_string(len);
-    if (len < 10)
-        msgSend += "   ";
-    else if (len < 100)
-        msgSend += "  ";
-    else if (len < 1000)
-        msgSend += " ";
-    msgSend += "\n";
-    msgSend += msg;
-
     qDebug() << "Sending Msg: ";
     qDebug() << "**************************************";
-    qDebug() << QString::fromStdString(msgSend);
+    qDebug() << QString::fromStdString(msg);
     qDebug() << "**************************************";
 
-    send(socketfd, msgSend.c_str(), len + 12, 0);
+    return sendFrame(FRAME_JSON, msg.data(), msg.length());
+}
+
+bool Client::sendFrame(uint8_t kind, const char* body, size_t length) {
+    // Hold the lock from the header on, a frame encoded before the switch to
+    // binary must not go out after one encoded after it
+    std::lock_guard<std::mutex> lock(sendMutex);
+    char header[MAX_HEADER_LENGTH];
+    size_t headerLength = encodeFrameHeader(header, framing, kind, length);
+    if (headerLength == 0)
+        return false;
+
+    std::string msgSend;
+    msgSend.reserve(headerLength + length);
+    msgSend.append(header, headerLength);
+    if (length > 0)
+        msgSend.append(body, length);
+
+    const char* data = msgSend.c_str();
+    int left = int(msgSend.length());
+    while (left > 0) {
+        int n = send(socketfd, data, left, SEND_FLAGS);
+        if (n <= 0)
+            return false;
+        data += n;
+        left -= n;
+    }
     return true;
 }
 
 
 int Client::recvJsonMsg(Json::Value& root) {
-    char temp[8] = { 0 };
-    char lengthStr[5] = { 0 };
-    char msgLengthInfo[13] = { 0 };
-
-    int n = recv(socketfd, msgLengthInfo, 12, 0);
-    if (n <= 0)
+    FrameView frame;
+    int ret = FrameDecoder::FRAME_NEED_MORE;
+
+    // Keep reading until one whole frame has been received
+    while ((ret = decoder.next(frame)) == FrameDecoder::FRAME_NEED_MORE) {
+        int readRet = decoder.readFrom(socketfd);
+        if (readRet == FrameDecoder::READ_CLOSED)
+            return -1;
+        if (readRet == FrameDecoder::READ_OK) {
+            lastReceived = std::chrono::steady_clock::now();
+            continue;
+        }
+        // The server answers every ping, silence means it or the network is gone
+        if (heartbeatSupported && heartbeatIntervalMs > 0 && std::chrono::steady_clock::now() - lastReceived >
+                std::chrono::milliseconds(heartbeatIntervalMs * heartbeatMissCount)) {
+            qDebug() << "Heartbeat lost";
+            return -1;
+        }
+    }
+    // The stream can't be resynchronized after a bad header
+    if (ret == FrameDecoder::FRAME_BAD)
         return -1;
-    if (n < 12)
+    // Pongs only keep the connection alive, the first one tells us the server
+    // understands pings
+    if (frame.kind == FRAME_PONG) {
+        heartbeatSupported = true;
         return 0;
-
-    memcpy(temp, msgLengthInfo, 7);
-    memcpy(lengthStr, msgLengthInfo+7, 4);
-    temp[7] = 0;
-    if (strcmp(temp, "length:") != 0)
+    }
+    // The server accepted binary framing, use it from now on
+    if (frame.framing == FRAMING_BINARY)
+        framing = FRAMING_BINARY;
+    // Binary move, hand it to the dialogs as the usual new_piece notify
+    if (frame.kind == FRAME_MOVE) {
+        int row, col, chessType;
+        if (!decodeMove(frame.data, frame.length, row, col, chessType))
+            return 0;
+        root["type"] = "notify";
+        root["sub_type"] = "new_piece";
+        root["row"] = row;
+        root["col"] = col;
+        root["chess_type"] = chessType;
+        return 1;
+    }
+    // Move list sent when we start watching, handed over as a move_list notify
+    if (frame.kind == FRAME_MOVE_LIST) {
+        Json::Value moves(Json::arrayValue);
+        for (size_t i = 0; i < frame.length; ++i)
+            moves.append(uint8_t(frame.data[i]));
+        root["type"] = "notify";
+        root["sub_type"] = "move_list";
+        root["moves"] = moves;
+        return 1;
+    }
+    if (frame.kind != FRAME_JSON)
         return 0;
 
-    int msgLength = 0;
-    sscanf(lengthStr, "%d", &msgLength);
-
-    char* jsonMsg = new char[msgLength+1];
-    jsonMsg[msgLength] = 0;
-    n = recv(socketfd, jsonMsg, msgLength, 0);
-
-    bool ret = 0;
-
-    do {
-        if (n <= 0) {
-            ret = -1;
-            break;
-        }
-        if (n < msgLength) {
-            break;
-        }
-
-        Json::Reader reader;
-        if (!reader.parse(jsonMsg, root))
-            break;
-
-        ret = 1;
-    } while (false);
-
-    if (ret == 1) {
-        qDebug() << "Recving Msg: ";
-        qDebug() << "**************************************";
-        qDebug() << QString(jsonMsg);
-        qDebug() << "**************************************";
-    }
+    Json::Reader reader;
+    if (!reader.parse(frame.data, frame.data + frame.length, root))
+        return 0;
 
-    delete[] jsonMsg;
-    return ret;
+    qDebug() << "Recving Msg: ";
+    qDebug() << "**************************************";
+    qDebug() << QString::fromUtf8(frame.data, int(frame.length));
+    qDebug() << "**************************************";
+    return 1;
 }
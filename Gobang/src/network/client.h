@@ -1,9 +1,20 @@
 #ifndef CLIENT_H
 #define CLIENT_H
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <json/json.h>
 
+#include "frame.h"
+#include "framedecoder.h"
+
+#define HEARTBEAT_INTERVAL_MS   5000
+#define HEARTBEAT_MISS_COUNT    3
+
 class Client {
 public:
     Client() {}
@@ -17,8 +28,19 @@ public:
 
     bool sendJsonMsg(const Json::Value& json);
     bool sendJsonMsg(const std::string& msg);
+    bool sendFrame(uint8_t kind, const char* body, size_t length);
     int recvJsonMsg(Json::Value& root);
 
+    // Text framing until the server answers with a binary frame
+    Framing getFraming() const { return framing; }
+
+    // Ping the server every intervalMs. recvJsonMsg() reports the connection
+    // as lost once nothing has arrived for missCount intervals.
+    // connectServer() starts it with the defaults above, but nothing is sent
+    // until the server has shown it understands pings by sending a pong.
+    void startHeartbeat(int intervalMs, int missCount);
+    void stopHeartbeat();
+
     const char* getServerIp() const { return serverIp.c_str(); }
     int getServerPort() const { return serverPort; }
 
@@ -31,6 +53,20 @@ private:
 #endif
     std::string serverIp;
     int serverPort;
+
+    FrameDecoder decoder;   // bytes received but not parsed yet
+    std::atomic<Framing> framing{FRAMING_TEXT};    // switched by the receiving thread, read by every sender
+
+    std::mutex sendMutex;   // the heartbeat thread sends too
+
+    std::thread heartbeatThread;
+    std::mutex heartbeatMutex;
+    std::condition_variable heartbeatCond;
+    bool heartbeatStop = false;
+    std::atomic<int> heartbeatIntervalMs{0};    // 0 when not running
+    std::atomic<int> heartbeatMissCount{0};
+    std::atomic<bool> heartbeatSupported{false};    // the server has sent a pong
+    std::chrono::steady_clock::time_point lastReceived;     // only used by the receiving thread
 };
 
 #endif // CLIENT_H
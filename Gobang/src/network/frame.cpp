@@ -0,0 +1,71 @@
+#include "frame.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+bool isKnownFrameKind(uint8_t kind) {
+    return kind == FRAME_JSON || kind == FRAME_MOVE || kind == FRAME_PING || kind == FRAME_PONG ||
+        kind == FRAME_MOVE_LIST;
+}
+
+size_t encodeFrameHeader(char* out, Framing framing, uint8_t kind, size_t bodyLength) {
+    // Heartbeats are always binary, two bytes in total, whatever the connection uses
+    if (kind == FRAME_PING || kind == FRAME_PONG)
+        framing = FRAMING_BINARY;
+    if (framing == FRAMING_TEXT) {
+        // Text frames can only carry json
+        if (kind != FRAME_JSON || bodyLength > MAX_TEXT_BODY_LENGTH)
+            return 0;
+        // Pad the length with spaces to 4 characters
+        char header[TEXT_HEADER_LENGTH + 1];
+        snprintf(header, sizeof(header), "length:%-4u\n", unsigned(bodyLength));
+        memcpy(out, header, TEXT_HEADER_LENGTH);
+        return TEXT_HEADER_LENGTH;
+    }
+
+    if (bodyLength > MAX_BINARY_BODY_LENGTH)
+        return 0;
+
+    size_t n = 0;
+    out[n++] = char(kind);
+    uint32_t value = uint32_t(bodyLength);
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        if (value)
+            byte |= 0x80;
+        out[n++] = char(byte);
+    } while (value);
+    return n;
+}
+
+int decodeVarint(const uint8_t* data, size_t size, uint32_t& value) {
+    value = 0;
+    for (size_t i = 0; i < MAX_VARINT_LENGTH; ++i) {
+        if (i >= size)
+            return 0;
+        value |= uint32_t(data[i] & 0x7F) << (7 * i);
+        if (!(data[i] & 0x80))
+            return int(i + 1);
+    }
+    return -1;
+}
+
+void encodeMove(char* out, int row, int col, int chessType) {
+    out[0] = char(row * 15 + col);
+    out[1] = char(chessType == 1 ? 1 : 0);
+}
+
+bool decodeMove(const char* data, size_t length, int& row, int& col, int& chessType) {
+    if (length != MOVE_BODY_LENGTH)
+        return false;
+    uint8_t index = uint8_t(data[0]);
+    uint8_t colour = uint8_t(data[1]);
+    if (index >= 15 * 15 || colour > 1)
+        return false;
+    row = index / 15;
+    col = index % 15;
+    chessType = colour ? 1 : -1;
+    return true;
+}
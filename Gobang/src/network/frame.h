@@ -0,0 +1,42 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// How frames are delimited on a connection
+enum Framing {
+    FRAMING_TEXT = 0,       // |length:xxxx\n|body|, body is at most 9999 bytes
+    FRAMING_BINARY = 1      // |kind|varint length|body|
+};
+
+// Kind of a binary frame. Never equal to 'l', so both framings can be
+// told apart by their first byte.
+enum FrameKind {
+    FRAME_JSON = 0x01,
+    FRAME_MOVE = 0x02,      // |cell index row*15+col|colour 0 black, 1 white|
+    FRAME_PING = 0x03,      // Heartbeat sent by the client, empty body
+    FRAME_PONG = 0x04,      // Heartbeat answer from the server, empty body
+    FRAME_MOVE_LIST = 0x05  // Moves played so far, one byte each (row*15+col), black first
+};
+
+#define TEXT_HEADER_LENGTH      12
+#define MAX_TEXT_BODY_LENGTH    9999
+#define MAX_HEADER_LENGTH       12
+#define MAX_VARINT_LENGTH       5
+#define MAX_BINARY_BODY_LENGTH  (64 << 10)     // largest real message (board, move list) is far smaller; longer headers are rejected before buffering
+#define MOVE_BODY_LENGTH        2
+
+bool isKnownFrameKind(uint8_t kind);
+
+// Returns the length of the header written to out, 0 if the body is too long
+size_t encodeFrameHeader(char* out, Framing framing, uint8_t kind, size_t bodyLength);
+
+// Fixed-size move message, chessType is -1 (black) or 1 (white)
+void encodeMove(char* out, int row, int col, int chessType);
+bool decodeMove(const char* data, size_t length, int& row, int& col, int& chessType);
+
+// Returns the number of bytes used, 0 if more data is needed, -1 if malformed
+int decodeVarint(const uint8_t* data, size_t size, uint32_t& value);
+
+#endif // FRAME_H
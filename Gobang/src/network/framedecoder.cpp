@@ -0,0 +1,141 @@
+#include "framedecoder.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#ifdef WIN32
+    #include <winsock2.h>
+#else
+    #include <errno.h>
+    #include <sys/types.h>
+    #include <sys/socket.h>
+#endif
+
+
+static size_t roundUpPowerOf2(size_t n) {
+    size_t cap = 1;
+    while (cap < n)
+        cap <<= 1;
+    return cap;
+}
+
+
+FrameDecoder::FrameDecoder(size_t initCapacity) :
+    buffer(roundUpPowerOf2(initCapacity))
+{
+}
+
+int FrameDecoder::readFrom(Socket fd) {
+    if (space() == 0)
+        grow(buffer.size() * 2);
+
+    size_t start = tail & mask();
+    size_t len = std::min(space(), buffer.size() - start);
+    int n = ::recv(fd, &buffer[start], int(len), 0);
+#ifndef WIN32
+    while (n < 0 && errno == EINTR)
+        n = ::recv(fd, &buffer[start], int(len), 0);
+#endif
+
+    // SO_RCVTIMEO expired, the connection is still open
+#ifdef WIN32
+    if (n < 0 && WSAGetLastError() == WSAETIMEDOUT)
+        return READ_TIMEOUT;
+#else
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return READ_TIMEOUT;
+#endif
+    if (n <= 0)
+        return READ_CLOSED;
+    tail += n;
+    return READ_OK;
+}
+
+int FrameDecoder::next(FrameView& frame) {
+    head += pending;
+    pending = 0;
+
+    size_t headerLength = 0, msgLength = 0;
+    int ret = parseHeader(headerLength, msgLength, frame);
+    if (ret != FRAME_OK)
+        return ret;
+
+    size_t frameLength = headerLength + msgLength;
+    if (size() < frameLength) {
+        // The whole frame doesn't fit, grow so the rest can be read
+        if (frameLength > buffer.size())
+            grow(frameLength);
+        return FRAME_NEED_MORE;
+    }
+
+    size_t start = (head + headerLength) & mask();
+    if (start + msgLength <= buffer.size()) {
+        frame.data = &buffer[start];
+    }
+    else {
+        scratch.resize(msgLength);
+        copyOut(head + headerLength, &scratch[0], msgLength);
+        frame.data = scratch.data();
+    }
+    frame.length = msgLength;
+    pending = frameLength;
+    return FRAME_OK;
+}
+
+int FrameDecoder::parseHeader(size_t& headerLength, size_t& bodyLength, FrameView& frame) const {
+    if (size() == 0)
+        return FRAME_NEED_MORE;
+
+    char header[MAX_HEADER_LENGTH + 1] = { 0 };
+    size_t peek = std::min(size(), size_t(MAX_HEADER_LENGTH));
+    copyOut(head, header, peek);
+
+    // Text frame |length:xxxx\n|
+    if (header[0] == 'l') {
+        if (peek < TEXT_HEADER_LENGTH)
+            return FRAME_NEED_MORE;
+        int msgLength = 0;
+        if (memcmp(header, "length:", 7) != 0 ||
+                sscanf(header + 7, "%4d", &msgLength) != 1 || msgLength < 0)
+            return FRAME_BAD;
+        headerLength = TEXT_HEADER_LENGTH;
+        bodyLength = msgLength;
+        frame.kind = FRAME_JSON;
+        frame.framing = FRAMING_TEXT;
+        return FRAME_OK;
+    }
+
+    // Binary frame |kind|varint length|
+    uint8_t kind = uint8_t(header[0]);
+    if (!isKnownFrameKind(kind))
+        return FRAME_BAD;
+    uint32_t msgLength = 0;
+    int n = decodeVarint((const uint8_t*)header + 1, peek - 1, msgLength);
+    if (n == 0)
+        return FRAME_NEED_MORE;
+    if (n < 0 || msgLength > MAX_BINARY_BODY_LENGTH)
+        return FRAME_BAD;
+    headerLength = 1 + n;
+    bodyLength = msgLength;
+    frame.kind = kind;
+    frame.framing = FRAMING_BINARY;
+    return FRAME_OK;
+}
+
+void FrameDecoder::copyOut(size_t pos, char* dst, size_t len) const {
+    size_t start = pos & mask();
+    size_t first = std::min(len, buffer.size() - start);
+    memcpy(dst, &buffer[start], first);
+    memcpy(dst + first, &buffer[0], len - first);
+}
+
+void FrameDecoder::grow(size_t minCapacity) {
+    std::vector<char> newBuffer(roundUpPowerOf2(minCapacity));
+    size_t used = size();
+    copyOut(head, newBuffer.data(), used);
+    buffer.swap(newBuffer);
+    head = 0;
+    tail = used;
+}
@@ -0,0 +1,65 @@
+#ifndef FRAMEDECODER_H
+#define FRAMEDECODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "frame.h"
+
+// A view of one frame inside the decoder's buffer.
+// Valid until the next call to next() or readFrom().
+struct FrameView {
+    const char* data = nullptr;
+    size_t length = 0;
+    uint8_t kind = FRAME_JSON;          // always FRAME_JSON for text frames
+    Framing framing = FRAMING_TEXT;     // framing of this frame
+};
+
+// Incremental frame decoder.
+// Bytes are accumulated in a ring buffer so short reads never desync the
+// stream, and complete frames are handed out as views without copying.
+// Text and binary frames are told apart by their first byte.
+class FrameDecoder
+{
+public:
+    enum { READ_CLOSED = -1, READ_TIMEOUT = 0, READ_OK = 1 };
+    enum { FRAME_BAD = -1, FRAME_NEED_MORE = 0, FRAME_OK = 1 };
+
+    explicit FrameDecoder(size_t initCapacity = 4096);
+
+public:
+#ifdef WIN32
+    typedef unsigned long long Socket;
+#else
+    typedef int Socket;
+#endif
+
+    // One blocking recv() into the free space of the buffer,
+    // READ_TIMEOUT if the socket's receive timeout expired first
+    int readFrom(Socket fd);
+
+    // Get the next complete frame, the previous one is released
+    int next(FrameView& frame);
+
+    void clear() { head = tail = pending = 0; }
+
+private:
+    size_t size() const { return tail - head; }
+    size_t space() const { return buffer.size() - size(); }
+    size_t mask() const { return buffer.size() - 1; }
+    void copyOut(size_t pos, char* dst, size_t len) const;
+    int parseHeader(size_t& headerLength, size_t& bodyLength, FrameView& frame) const;
+    void grow(size_t minCapacity);
+
+private:
+    std::vector<char> buffer;   // capacity is always a power of 2
+    size_t head = 0;            // read position (monotonic)
+    size_t tail = 0;            // write position (monotonic)
+    size_t pending = 0;         // bytes of the frame returned by the last next()
+    std::string scratch;        // used when a frame wraps around the end of the buffer
+};
+
+#endif // FRAMEDECODER_H
@@ -0,0 +1,36 @@
+#include <benchmark/benchmark.h>
+
+#include <signal.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+
+//默认把结果写成json，方便比较两次构建的结果：
+//  gobang_bench                                    结果写到bench_results.json
+//  gobang_bench --benchmark_out=other.json         指定文件
+int main(int argc, char** argv) {
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<char*> args(argv, argv + argc);
+    std::string out = "--benchmark_out=bench_results.json";
+    std::string format = "--benchmark_out_format=json";
+    bool hasOut = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--benchmark_out=", 16) == 0)
+            hasOut = true;
+    }
+    if (!hasOut) {
+        args.push_back(&out[0]);
+        args.push_back(&format[0]);
+    }
+
+    int count = int(args.size());
+    benchmark::Initialize(&count, args.data());
+    if (benchmark::ReportUnrecognizedArguments(count, args.data()))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "connection.h"
+#include "socket_func.h"
+
+#include <sys/socket.h>
+
+#include <memory>
+
+
+//一对本地socket，a端注册为服务器的连接，b端模拟客户端
+struct SocketPair {
+    SocketFD a = -1;
+    SocketFD b = -1;
+
+    SocketPair() {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0) {
+            a = fds[0];
+            b = fds[1];
+            setNonBlocking(a);
+            Connection::add(std::make_shared<Connection>(a));
+        }
+    }
+
+    ~SocketPair() {
+        Connection::remove(a);
+        closeSocket(a);
+        closeSocket(b);
+    }
+
+    //读掉b端收到的所有数据，避免发送缓冲区被写满
+    void drain() const {
+        char buf[65536];
+        while (recv(b, buf, sizeof(buf), MSG_DONTWAIT) > 0) { }
+    }
+};
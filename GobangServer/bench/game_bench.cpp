@@ -0,0 +1,198 @@
+//房间的消息分发和胜负判断
+
+#include "bench_util.h"
+
+#include "bitboard.h"
+#include "room.h"
+#include "room_store.h"
+#include "thread_pool.h"
+#include "win_detector.h"
+
+#include "jsoncpp/json/json.h"
+
+#include <benchmark/benchmark.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <memory>
+#include <vector>
+
+
+//一局不出现连五的落子顺序，黑白交替，用来反复下满一局而不提前结束
+static const std::vector<ChessPieceInfo>& drawSequence() {
+    static std::vector<ChessPieceInfo> moves = [](){
+        std::vector<ChessPieceInfo> seq;
+        BitBoard board;
+        ChessType turn = CHESS_BLACK;
+        bool placed = true;
+        while (placed) {
+            placed = false;
+            for (int i = 0; i < BitBoard::SIZE * BitBoard::SIZE && !placed; ++i) {
+                int cell = (i * 37) % (BitBoard::SIZE * BitBoard::SIZE);
+                int row = cell / BitBoard::SIZE, col = cell % BitBoard::SIZE;
+                if (!board.isEmpty(row, col))
+                    continue;
+                board.set(row, col, turn);
+                if (board.hasFiveAt(row, col, turn)) {
+                    board.set(row, col, CHESS_NULL);
+                    continue;
+                }
+                seq.push_back({ row, col, turn });
+                turn = reverse(turn);
+                placed = true;
+            }
+        }
+        return seq;
+    }();
+    return moves;
+}
+
+//两名玩家的房间，都连在socketpair上
+struct BenchRoom {
+    ThreadPool pool;
+    SocketPair black;
+    SocketPair white;
+    std::shared_ptr<Room> room;
+
+    BenchRoom() : pool(1), room(std::make_shared<Room>(pool)) {
+        room->addPlayer("black", black.a);
+        room->addPlayer("white", white.a);
+    }
+
+    void startGame() {
+        Json::Value prepare;
+        prepare["type"] = "command";
+        prepare["cmd"] = "prepare";
+        room->parseJsonMsg(prepare, black.a);
+        room->parseJsonMsg(prepare, white.a);
+        black.drain();
+        white.drain();
+    }
+};
+
+
+static void BM_RoomDispatchChat(benchmark::State& state) {
+    BenchRoom bench;
+    Json::Value chat;
+    chat["type"] = "chat";
+    chat["player_name"] = "black";
+    chat["message"] = "good game";
+
+    for (auto _ : state) {
+        bench.room->parseJsonMsg(chat, bench.black.a);
+        bench.white.drain();
+    }
+}
+BENCHMARK(BM_RoomDispatchChat);
+
+//json落子：校验、落子、广播、判断胜负
+static void BM_RoomDispatchNewPiece(benchmark::State& state) {
+    BenchRoom bench;
+    const std::vector<ChessPieceInfo>& moves = drawSequence();
+    std::vector<Json::Value> msgs;
+    for (const ChessPieceInfo& move : moves) {
+        Json::Value root;
+        root["type"] = "notify";
+        root["sub_type"] = "new_piece";
+        root["row"] = move.row;
+        root["col"] = move.col;
+        root["chess_type"] = move.type;
+        msgs.push_back(root);
+    }
+
+    size_t next = msgs.size();
+    for (auto _ : state) {
+        if (next == msgs.size()) {
+            state.PauseTiming();
+            bench.startGame();
+            next = 0;
+            state.ResumeTiming();
+        }
+        SocketPair& mover = moves[next].type == CHESS_BLACK ? bench.black : bench.white;
+        SocketPair& rival = moves[next].type == CHESS_BLACK ? bench.white : bench.black;
+        bench.room->parseJsonMsg(msgs[next++], mover.a);
+        rival.drain();
+    }
+}
+BENCHMARK(BM_RoomDispatchNewPiece);
+
+//整个棋盘扫描一遍
+static void BM_BitBoardHasFive(benchmark::State& state) {
+    BitBoard board;
+    const std::vector<ChessPieceInfo>& moves = drawSequence();
+    for (size_t i = 0; i < moves.size() && int(i) < state.range(0); ++i)
+        board.set(moves[i].row, moves[i].col, ChessType(moves[i].type));
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(board.hasFive(CHESS_BLACK));
+        benchmark::DoNotOptimize(board.hasFive(CHESS_WHITE));
+    }
+}
+BENCHMARK(BM_BitBoardHasFive)->Arg(20)->Arg(120);
+
+//客户端ChessBoard::judge的做法：只检查经过最后一步的四条线
+static void BM_BitBoardHasFiveAt(benchmark::State& state) {
+    BitBoard board;
+    const std::vector<ChessPieceInfo>& moves = drawSequence();
+    for (const ChessPieceInfo& move : moves)
+        board.set(move.row, move.col, ChessType(move.type));
+
+    size_t next = 0;
+    for (auto _ : state) {
+        const ChessPieceInfo& move = moves[next];
+        benchmark::DoNotOptimize(board.hasFiveAt(move.row, move.col, ChessType(move.type)));
+        next = next + 1 == moves.size() ? 0 : next + 1;
+    }
+}
+BENCHMARK(BM_BitBoardHasFiveAt);
+
+//服务器的做法：每步落子增量更新连线长度
+static void BM_WinDetectorPlace(benchmark::State& state) {
+    const std::vector<ChessPieceInfo>& moves = drawSequence();
+    BitBoard board;
+    WinDetector detector;
+
+    size_t next = moves.size();
+    for (auto _ : state) {
+        if (next == moves.size()) {
+            state.PauseTiming();
+            board.clear();
+            detector.clear();
+            next = 0;
+            state.ResumeTiming();
+        }
+        const ChessPieceInfo& move = moves[next++];
+        board.set(move.row, move.col, ChessType(move.type));
+        benchmark::DoNotOptimize(detector.place(board, move.row, move.col, ChessType(move.type)));
+    }
+}
+BENCHMARK(BM_WinDetectorPlace);
+
+//每步落子写一次状态文件的槽位，只有内存拷贝
+static void BM_RoomStoreSave(benchmark::State& state) {
+    char path[] = "/tmp/gobang_bench_store_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd >= 0)
+        close(fd);
+    RoomStore store;
+    if (fd < 0 || !store.open(path, 1000, 9999)) {
+        state.SkipWithError("cannot open state file");
+        return;
+    }
+
+    RoomRecord record;
+    memset(&record, 0, sizeof(record));
+    record.id = 1234;
+    RoomStore::copyName(record.name, "bench");
+    BitBoard board;
+    for (auto _ : state) {
+        ++record.moveNumber;
+        board.save(record.bits);
+        store.save(record);
+    }
+    store.close();
+    unlink(path);
+}
+BENCHMARK(BM_RoomStoreSave);
@@ -0,0 +1,147 @@
+//消息收发和json序列化、解析的开销
+
+#include "bench_util.h"
+
+#include "api.h"
+#include "bitboard.h"
+
+#include "jsoncpp/json/json.h"
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <vector>
+
+
+//从服务器日志里截取的真实消息
+static const char* const capturedFrames[] = {
+    "{\"cmd\":\"create_room\",\"player_name\":\"xfd\",\"room_name\":\"test\",\"type\":\"command\"}",
+    "{\"cmd\":\"join_room\",\"player_name\":\"xfd2\",\"room_id\":5455,\"type\":\"command\"}",
+    "{\"chess_type\":-1,\"col\":7,\"row\":14,\"sub_type\":\"new_piece\",\"type\":\"notify\"}",
+    "{\"desc\":\"\",\"res_cmd\":\"join_room\",\"rival_name\":\"xfd\",\"room_name\":\"test\",\"status\":0,\"type\":\"response\"}",
+    "{\"player1_chess_type\":-1,\"player1_name\":\"h0\",\"player2_chess_type\":1,\"player2_name\":\"g0\",\"sub_type\":\"player_info\",\"type\":\"notify\"}",
+};
+
+static std::string capturedChessBoard() {
+    BitBoard board;
+    for (int i = 0; i < 60; ++i)
+        board.set((i * 7) % 15, (i * 11) % 15, i % 2 ? CHESS_WHITE : CHESS_BLACK);
+    Json::Value root;
+    Json::Value layout;
+    root["type"] = "notify";
+    root["sub_type"] = "chessboard";
+    for (int row = 0; row < BitBoard::SIZE; ++row)
+        for (int col = 0; col < BitBoard::SIZE; ++col)
+            layout.append(board.get(row, col));
+    root["layout"] = layout;
+    root["last_piece"]["row"] = 7;
+    root["last_piece"]["col"] = 8;
+    root["last_piece"]["type"] = 1;
+    return Json::FastWriter().write(root);
+}
+
+
+static void BM_SendRecvJsonMsg(benchmark::State& state) {
+    SocketPair pair;
+    Json::Value msg;
+    msg["type"] = "notify";
+    msg["sub_type"] = "new_piece";
+    msg["row"] = 7;
+    msg["col"] = 7;
+    msg["chess_type"] = -1;
+
+    for (auto _ : state) {
+        sendJsonMsg(msg, pair.a);
+        Json::Value root;
+        benchmark::DoNotOptimize(recvJsonMsg(root, pair.b));
+    }
+}
+BENCHMARK(BM_SendRecvJsonMsg);
+
+static void BM_NotifyNewPiece(benchmark::State& state) {
+    SocketPair pair;
+    for (auto _ : state) {
+        API::notifyNewPiece(pair.a, 7, 8, CHESS_WHITE);
+        pair.drain();
+    }
+}
+BENCHMARK(BM_NotifyNewPiece);
+
+static void BM_SendChessBoard(benchmark::State& state) {
+    SocketPair pair;
+    BitBoard board;
+    for (int i = 0; i < state.range(0); ++i)
+        board.set((i * 7) % 15, (i * 11) % 15, i % 2 ? CHESS_WHITE : CHESS_BLACK);
+    ChessPieceInfo last = { 7, 8, CHESS_WHITE };
+
+    for (auto _ : state) {
+        API::sendChessBoard(pair.a, board, last);
+        pair.drain();
+    }
+}
+BENCHMARK(BM_SendChessBoard)->Arg(0)->Arg(60)->Arg(200);
+
+//房间缓存的观众加入内容：编码一次，之后每个观众只是排队
+static void BM_SendCachedChessBoard(benchmark::State& state) {
+    SocketPair pair;
+    BitBoard board;
+    for (int i = 0; i < state.range(0); ++i)
+        board.set((i * 7) % 15, (i * 11) % 15, i % 2 ? CHESS_WHITE : CHESS_BLACK);
+    Packet packet = API::packChessBoard(board, { 7, 8, CHESS_WHITE });
+
+    for (auto _ : state) {
+        sendPacket(packet, pair.a);
+        pair.drain();
+    }
+}
+BENCHMARK(BM_SendCachedChessBoard)->Arg(0)->Arg(60)->Arg(200);
+
+static void BM_NotifyPlayerInfo(benchmark::State& state) {
+    SocketPair pair;
+    for (auto _ : state) {
+        API::notifyPlayerInfo(pair.a, "player_one", CHESS_BLACK, "player_two", CHESS_WHITE);
+        pair.drain();
+    }
+}
+BENCHMARK(BM_NotifyPlayerInfo);
+
+//只序列化，不发送
+static void BM_PackNewPiece(benchmark::State& state) {
+    for (auto _ : state)
+        benchmark::DoNotOptimize(API::packNewPiece(7, 8, CHESS_WHITE));
+}
+BENCHMARK(BM_PackNewPiece);
+
+static void BM_PackPlayerInfo(benchmark::State& state) {
+    for (auto _ : state)
+        benchmark::DoNotOptimize(API::packPlayerInfo("player_one", CHESS_BLACK, "player_two", CHESS_WHITE));
+}
+BENCHMARK(BM_PackPlayerInfo);
+
+static void BM_ParseCapturedFrames(benchmark::State& state) {
+    std::vector<std::string> frames(std::begin(capturedFrames), std::end(capturedFrames));
+    size_t bytes = 0;
+    for (const std::string& frame : frames)
+        bytes += frame.size();
+
+    Json::Reader reader;
+    for (auto _ : state) {
+        for (const std::string& frame : frames) {
+            Json::Value root;
+            benchmark::DoNotOptimize(reader.parse(frame, root));
+        }
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * bytes);
+}
+BENCHMARK(BM_ParseCapturedFrames);
+
+static void BM_ParseChessBoard(benchmark::State& state) {
+    std::string frame = capturedChessBoard();
+    Json::Reader reader;
+    for (auto _ : state) {
+        Json::Value root;
+        benchmark::DoNotOptimize(reader.parse(frame, root));
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * frame.size());
+}
+BENCHMARK(BM_ParseChessBoard);
@@ -0,0 +1,106 @@
+#include "admin_server.h"
+
+#include "logger.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <string>
+
+
+bool AdminServer::start(int port) {
+    listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenfd < 0) {
+        LOG_ERROR("create admin socket error: %s(errno: %d)", strerror(errno), errno);
+        return false;
+    }
+
+    int on = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, (const char*)&on, sizeof(on));
+
+    //只允许本机访问
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    if (bind(listenfd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(listenfd, 16) == -1) {
+        LOG_ERROR("admin socket bind/listen error: %s(errno: %d)", strerror(errno), errno);
+        closeSocket(listenfd);
+        listenfd = -1;
+        return false;
+    }
+
+    running = true;
+    thread = std::thread([this](){ run(); });
+    LOG_INFO("Admin endpoint on 127.0.0.1:%d", port);
+    return true;
+}
+
+//shutdown让阻塞的accept返回
+void AdminServer::stop() {
+    if (!running.exchange(false))
+        return;
+    shutdown(listenfd, SHUT_RDWR);
+    if (thread.joinable())
+        thread.join();
+    closeSocket(listenfd);
+    listenfd = -1;
+}
+
+void AdminServer::run() {
+    while (running) {
+        SocketFD fd = accept(listenfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        handleClient(fd);
+        closeSocket(fd);
+    }
+}
+
+//HTTP/1.0，一个连接只处理一个请求
+void AdminServer::handleClient(SocketFD fd) {
+    //客户端不发请求时不能一直卡住这个线程
+    struct timeval timeout = { 2, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeout, sizeof(timeout));
+
+    //只需要请求行
+    std::string request;
+    char buf[1024];
+    while (request.find("\r\n") == std::string::npos && request.size() < 8192) {
+        int n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0)
+            return;
+        request.append(buf, n);
+    }
+
+    std::string status, body, contentType = "text/plain; charset=utf-8";
+    if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 13, "GET /metrics?") == 0) {
+        status = "200 OK";
+        body = Metrics::render();
+        contentType = "text/plain; version=0.0.4; charset=utf-8";
+    }
+    else {
+        status = "404 Not Found";
+        body = "not found\n";
+    }
+
+    std::string response = "HTTP/1.0 " + status + "\r\nContent-Type: " + contentType +
+            "\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+    size_t sent = 0;
+    while (sent < response.size()) {
+        int n = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        sent += n;
+    }
+}
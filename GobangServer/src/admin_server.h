@@ -0,0 +1,26 @@
+#pragma once
+
+#include "socket_func.h"
+
+#include <atomic>
+#include <thread>
+
+
+//只监听127.0.0.1的管理端口，GET /metrics 返回Prometheus格式的指标。
+//请求很少，用一个单独的线程阻塞处理，不占用游戏的事件循环
+class AdminServer {
+public:
+    AdminServer() : listenfd(-1), running(false) { }
+    ~AdminServer() { stop(); }
+
+    bool start(int port);
+    void stop();
+
+private:
+    void run();
+    void handleClient(SocketFD fd);
+
+    SocketFD listenfd;
+    std::atomic<bool> running;
+    std::thread thread;
+};
@@ -1,8 +1,9 @@
 #include "api.h"
+#include "logger.h"
+#include "metrics.h"
 #include "socket_func.h"
 
 #include "jsoncpp/json/writer.h"
-#include <iostream>
 
 namespace API {
 
@@ -26,13 +27,6 @@ static bool sendSimpleRes(SocketFD fd, const std::string& res_cmd,
     return sendJsonMsg(root, fd);
 }
 
-static bool sendSimpleNotify(SocketFD fd, const std::string& sub_type) {
-    Json::Value root;
-    root["type"] = "notify";
-    root["sub_type"] = sub_type;
-    return sendJsonMsg(root, fd);
-}
-
 
 /******************************************
  * Check recieved message's type
@@ -48,6 +42,122 @@ bool isTypeNotify(const Json::Value& root, const std::string& sub_type) {
 }
 
 
+static Json::Value simpleNotify(const std::string& sub_type) {
+    Json::Value root;
+    root["type"] = "notify";
+    root["sub_type"] = sub_type;
+    return root;
+}
+
+
+/**************************************
+ * Serialize once, send to many
+**************************************/
+Packet pack(const Json::Value& root) {
+    std::string msg = Json::FastWriter().write(root);
+    LOG_TRACE("Sending message: %s", msg.c_str());
+
+    Packet packet;
+    packet.kind = FRAME_JSON;
+    packet.body = std::make_shared<const std::string>(std::move(msg));
+    packet.statKind = MessageStats::classify(root);
+    return packet;
+}
+
+Packet packNewPiece(int row, int col, int chess_type) {
+    Json::Value root;
+    root["type"] = "notify";
+    root["sub_type"] = "new_piece";
+    root["row"] = row;
+    root["col"] = col;
+    root["chess_type"] = chess_type;
+    Packet packet = pack(root);
+
+    //使用二进制分帧的客户端收到2字节的落子消息
+    if (row >= 0 && row < 15 && col >= 0 && col < 15) {
+        char body[MOVE_BODY_LENGTH];
+        encodeMove(body, row, col, chess_type);
+        packet.compactKind = FRAME_MOVE;
+        packet.compactBody = std::make_shared<const std::string>(body, MOVE_BODY_LENGTH);
+    }
+    return packet;
+}
+
+//使用二进制分帧的客户端收到每步一个字节的帧，文本分帧的客户端收到json数组
+Packet packMoveList(const std::vector<uint8_t>& moves) {
+    Json::Value root = simpleNotify("move_list");
+    Json::Value list(Json::arrayValue);
+    for (uint8_t move : moves)
+        list.append(move);
+    root["moves"] = list;
+    Packet packet = pack(root);
+
+    packet.compactKind = FRAME_MOVE_LIST;
+    packet.compactBody = std::make_shared<const std::string>((const char*)moves.data(), moves.size());
+    return packet;
+}
+
+Packet packGameStart() {
+    return pack(simpleNotify("game_start"));
+}
+
+Packet packGameCancelPrepare() {
+    return pack(simpleNotify("cancel_prepare"));
+}
+
+Packet packDisconnect(const std::string& player_name) {
+    Json::Value root = simpleNotify("disconnect");
+    root["player_name"] = player_name;
+    return pack(root);
+}
+
+Packet packServerShutdown() {
+    return pack(simpleNotify("server_shutdown"));
+}
+
+//和客户端发出的game_over格式相同
+Packet packGameOver(int chess_type, const std::string& reason) {
+    Json::Value root = simpleNotify("game_over");
+    root["game_result"] = chess_type == CHESS_NULL ? "draw" : "win";
+    root["chess_type"] = chess_type;
+    if (!reason.empty())
+        root["reason"] = reason;
+    return pack(root);
+}
+
+Packet packPlayerInfo(const std::string& player1_name, int player1_chess_type,
+        const std::string& player2_name, int player2_chess_type) {
+    Json::Value root = simpleNotify("player_info");
+    root["player1_name"] = player1_name;
+    root["player1_chess_type"] = player1_chess_type;
+    root["player2_name"] = player2_name;
+    root["player2_chess_type"] = player2_chess_type;
+    return pack(root);
+}
+
+Packet packChessBoard(const BitBoard& board, ChessPieceInfo last_piece) {
+    Json::Value root;
+    Json::Value chessboard;
+    Json::Value lastChess;
+    root["type"] = "notify";
+    root["sub_type"] = "chessboard";
+
+    for (int row = 0; row < BitBoard::SIZE; ++row) {
+        for (int col = 0; col < BitBoard::SIZE; ++col) {
+            chessboard.append(board.get(row, col));
+        }
+    }
+    root["layout"] = chessboard;
+
+    lastChess["row"] = last_piece.row;
+    lastChess["col"] = last_piece.col;
+    lastChess["type"] = last_piece.type;
+    root["last_piece"] = lastChess;
+
+    return pack(root);
+}
+
+
 /**************************************
  * Just forward to the other player 
 **************************************/
@@ -102,26 +212,8 @@ bool responsePrepare(SocketFD fd, int status_code, const std::string& desc) {
 /*************************
  * Type: Notify
 *************************/
-bool sendChessBoard(SocketFD fd, int chessPieces[][15], ChessPieceInfo last_piece) {
-    Json::Value root;
-    Json::Value chessboard;
-    Json::Value lastChess;
-    root["type"] = "notify";
-    root["sub_type"] = "chessboard";
-
-    for (int row = 0; row < 15; ++row) {
-        for (int col = 0; col < 15; ++col) {
-            chessboard.append(chessPieces[row][col]);
-        }
-    }
-    root["layout"] = chessboard;
-
-    lastChess["row"] = last_piece.row;
-    lastChess["col"] = last_piece.col;
-    lastChess["type"] = last_piece.type;
-    root["last_piece"] = lastChess;
-
-    return sendJsonMsg(root, fd);
+bool sendChessBoard(SocketFD fd, const BitBoard& board, ChessPieceInfo last_piece) {
+    return sendPacket(packChessBoard(board, last_piece), fd);
 }
 
 bool notifyRivalInfo(SocketFD fd, const std::string& player_name) {
@@ -133,43 +225,26 @@ bool notifyRivalInfo(SocketFD fd, const std::string& player_name) {
 }
 
 bool notifyNewPiece(SocketFD fd, int row, int col, int chess_type) {
-    Json::Value root;
-    root["type"] = "notify";
-    root["sub_type"] = "new_piece";
-    root["row"] = row;
-    root["col"] = col;
-    root["chess_type"] = chess_type;
-    return sendJsonMsg(root, fd);
+    return sendPacket(packNewPiece(row, col, chess_type), fd);
 }
 
 bool notifyGameStart(SocketFD fd) {
-    return sendSimpleNotify(fd, "game_start");
+    return sendPacket(packGameStart(), fd);
 }
 
 bool notifyGameCancelPrepare(SocketFD fd) {
-    return sendSimpleNotify(fd, "cancel_prepare");
+    return sendPacket(packGameCancelPrepare(), fd);
 }
 
 bool notifyDisconnect(SocketFD fd, const std::string& player_name) {
-    Json::Value root;
-    root["type"] = "notify";
-    root["sub_type"] = "disconnect";
-    root["player_name"] = player_name;
-    return sendJsonMsg(root, fd);
+    return sendPacket(packDisconnect(player_name), fd);
 }
 
 bool notifyPlayerInfo(SocketFD fd, const std::string& player1_name, int player1_chess_type,
         const std::string& player2_name, int player2_chess_type) {
-    Json::Value root;
-    root["type"] = "notify";
-    root["sub_type"] = "player_info";
-    root["player1_name"] = player1_name;
-    root["player1_chess_type"] = player1_chess_type;
-    root["player2_name"] = player2_name;
-    root["player2_chess_type"] = player2_chess_type;
-    return sendJsonMsg(root, fd);
+    return sendPacket(packPlayerInfo(player1_name, player1_chess_type,
+                player2_name, player2_chess_type), fd);
 }
 
 
 }; // namespace API
-
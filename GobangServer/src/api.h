@@ -1,7 +1,9 @@
 #include <string>
+#include <vector>
 #include "jsoncpp/json/json.h"
 #include "socket_func.h"
 #include "base.h"
+#include "bitboard.h"
 
 const int STATUS_OK = 0;
 const int STATUS_ERROR = 1;
@@ -13,6 +15,19 @@ bool isTypeNotify(const Json::Value& root, const std::string& sub_type);
 
 bool forward(SocketFD fd, const Json::Value& root);
 
+//只序列化一次，用于向多个连接广播
+Packet pack(const Json::Value& root);
+Packet packNewPiece(int row, int col, int chess_type);
+Packet packMoveList(const std::vector<uint8_t>& moves);                 //按顺序的落子，每步一个字节 row*15+col
+Packet packGameStart();
+Packet packGameCancelPrepare();
+Packet packDisconnect(const std::string& player_name);
+Packet packServerShutdown();                                            //服务器即将关闭
+Packet packGameOver(int chess_type, const std::string& reason = "");   //chess_type为CHESS_NULL表示和棋，reason为timeout表示对方超时
+Packet packPlayerInfo(const std::string& player1_name, int player1_chess_type,
+        const std::string& player2_name, int player2_chess_type);
+Packet packChessBoard(const BitBoard& board, ChessPieceInfo last_piece);
+
 // Type: Response
 bool responseCreateRoom(SocketFD fd, int status_code, const std::string& desc, int room_id);
 bool responseJoinRoom(SocketFD fd, int status_code, const std::string& desc,
@@ -22,7 +37,7 @@ bool responseWatchRoom(SocketFD fd, int status_code, const std::string& desc,
 bool responsePrepare(SocketFD fd, int status_code, const std::string& desc);
 
 // Type: command
-bool sendChessBoard(SocketFD fd, int chessPieces[][15], ChessPieceInfo last_piece);
+bool sendChessBoard(SocketFD fd, const BitBoard& board, ChessPieceInfo last_piece);
 
 // Tyep: Notify
 bool notifyRivalInfo(SocketFD fd, const std::string& player_name);
@@ -0,0 +1,155 @@
+#include "bitboard.h"
+
+
+void BitBoard::clear() {
+    for (int i = 0; i < WORDS; ++i) {
+        black[i] = 0;
+        white[i] = 0;
+    }
+}
+
+ChessType BitBoard::get(int row, int col) const {
+    if (black[word(row, col)] & mask(row, col))
+        return CHESS_BLACK;
+    if (white[word(row, col)] & mask(row, col))
+        return CHESS_WHITE;
+    return CHESS_NULL;
+}
+
+void BitBoard::set(int row, int col, ChessType type) {
+    if (row < 0 || row >= SIZE || col < 0 || col >= SIZE)
+        return;
+    int w = word(row, col);
+    uint64_t m = mask(row, col);
+    black[w] &= ~m;
+    white[w] &= ~m;
+    if (type == CHESS_BLACK)
+        black[w] |= m;
+    else if (type == CHESS_WHITE)
+        white[w] |= m;
+}
+
+int BitBoard::count() const {
+    int n = 0;
+    for (int i = 0; i < WORDS; ++i)
+        n += __builtin_popcountll(black[i]) + __builtin_popcountll(white[i]);
+    return n;
+}
+
+void BitBoard::save(uint64_t* out) const {
+    for (int i = 0; i < WORDS; ++i) {
+        out[i] = black[i];
+        out[WORDS + i] = white[i];
+    }
+}
+
+//每行第16位不用，文件里的数据不可信，顺便清掉；同一格黑白都有时算黑
+void BitBoard::load(const uint64_t* in) {
+    uint64_t valid = 0;
+    for (int col = 0; col < SIZE; ++col)
+        valid |= uint64_t(0x0001000100010001ull) << col;
+    for (int i = 0; i < WORDS; ++i) {
+        uint64_t mask = i == WORDS - 1 ? valid & 0x0000ffffffffffffull : valid;
+        black[i] = in[i] & mask;
+        white[i] = in[WORDS + i] & mask & ~black[i];
+    }
+}
+
+uint16_t BitBoard::rowBits(ChessType type, int row) const {
+    const uint64_t* bits = side(type);
+    return uint16_t(bits[row >> 2] >> ((row & 3) * STRIDE)) & 0x7FFF;
+}
+
+uint16_t BitBoard::colBits(ChessType type, int col) const {
+    const uint64_t* bits = side(type);
+    uint16_t out = 0;
+    for (int row = 0; row < SIZE; ++row) {
+        if (bits[word(row, col)] & mask(row, col))
+            out |= uint16_t(1) << row;
+    }
+    return out;
+}
+
+uint16_t BitBoard::lineBits(ChessType type, int row, int col, Direction dir, int& index) const {
+    int dRow = (dir == DIR_ROW) ? 0 : 1;
+    int dCol = (dir == DIR_ROW || dir == DIR_DIAG) ? 1 : (dir == DIR_COL ? 0 : -1);
+
+    //退回到这条线的起点
+    int back = SIZE;
+    if (dRow)
+        back = row;
+    if (dCol > 0 && col < back)
+        back = col;
+    if (dCol < 0 && SIZE - 1 - col < back)
+        back = SIZE - 1 - col;
+    index = back;
+
+    const uint64_t* bits = side(type);
+    uint16_t out = 0;
+    int r = row - dRow * back, c = col - dCol * back;
+    for (int i = 0; r < SIZE && c >= 0 && c < SIZE; ++i, r += dRow, c += dCol) {
+        if (bits[word(r, c)] & mask(r, c))
+            out |= uint16_t(1) << i;
+    }
+    return out;
+}
+
+//第i位表示从i开始的连五，只保留覆盖index的那些
+static bool fiveThrough(uint32_t line, int index) {
+    uint32_t starts = line & (line >> 1) & (line >> 2) & (line >> 3) & (line >> 4);
+    uint32_t window = index >= 4 ? (0x1Fu << (index - 4)) : (0x1Fu >> (4 - index));
+    return (starts & window) != 0;
+}
+
+bool BitBoard::hasFiveAt(int row, int col, ChessType type) const {
+    if (type == CHESS_NULL)
+        return false;
+
+    //横向直接取整行
+    if (fiveThrough(rowBits(type, row), col))
+        return true;
+
+    const Direction dirs[] = { DIR_COL, DIR_DIAG, DIR_ANTI };
+    for (Direction dir : dirs) {
+        int index;
+        uint16_t line = lineBits(type, row, col, dir, index);
+        if (fiveThrough(line, index))
+            return true;
+    }
+    return false;
+}
+
+void BitBoard::shiftDown(const uint64_t* in, int shift, uint64_t* out) {
+    int words = shift >> 6, bits = shift & 63;
+    for (int i = 0; i < WORDS; ++i) {
+        int from = i + words;
+        out[i] = from < WORDS ? in[from] >> bits : 0;
+        if (bits && from + 1 < WORDS)
+            out[i] |= in[from + 1] << (64 - bits);
+    }
+}
+
+bool BitBoard::hasFive(ChessType type) const {
+    if (type == CHESS_NULL)
+        return false;
+
+    const uint64_t* bits = side(type);
+    const int shifts[] = { DIR_ROW, DIR_COL, DIR_DIAG, DIR_ANTI };
+    for (int s : shifts) {
+        //m的第i位表示从i开始沿该方向连续2个、4个、5个棋子
+        uint64_t m[WORDS], t[WORDS];
+        shiftDown(bits, s, t);
+        for (int i = 0; i < WORDS; ++i)
+            m[i] = bits[i] & t[i];
+        shiftDown(m, 2 * s, t);
+        for (int i = 0; i < WORDS; ++i)
+            m[i] &= t[i];
+        shiftDown(bits, 4 * s, t);
+        uint64_t any = 0;
+        for (int i = 0; i < WORDS; ++i)
+            any |= m[i] & t[i];
+        if (any)
+            return true;
+    }
+    return false;
+}
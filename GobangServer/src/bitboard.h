@@ -0,0 +1,53 @@
+#pragma once
+
+#include "base.h"
+
+#include <stdint.h>
+
+
+//棋盘：黑白各用一个位集合表示。每行占16位，第16位空着不用，这样左右方向移位时不会串到相邻的行，
+//15行共240位，放在4个uint64里。判断连五时用移位和按位与一次处理一整个字，不需要逐格扫描
+class BitBoard {
+public:
+    enum { SIZE = 15, STRIDE = 16, WORDS = 4 };
+
+    //四个方向，值是沿该方向前进一格时位下标的增量
+    enum Direction {
+        DIR_ROW = 1,            //横
+        DIR_COL = STRIDE,       //竖
+        DIR_DIAG = STRIDE + 1,  //左上到右下
+        DIR_ANTI = STRIDE - 1   //右上到左下
+    };
+
+    BitBoard() { clear(); }
+
+public:
+    void clear();
+
+    ChessType get(int row, int col) const;
+    void set(int row, int col, ChessType type);     //type为CHESS_NULL时清除该格
+    bool isEmpty(int row, int col) const { return !((black[word(row, col)] | white[word(row, col)]) & mask(row, col)); }
+    int count() const;                              //棋子总数
+    void save(uint64_t* out) const;                 //先黑后白写出2 * WORDS个字，持久化用
+    void load(const uint64_t* in);
+
+    //取出一条线上的棋子，第i位对应这条线上的第i格；index返回(row, col)在这条线上的位置
+    uint16_t rowBits(ChessType type, int row) const;
+    uint16_t colBits(ChessType type, int col) const;
+    uint16_t lineBits(ChessType type, int row, int col, Direction dir, int& index) const;
+
+    bool hasFiveAt(int row, int col, ChessType type) const;     //是否有经过(row, col)的连五
+    bool hasFive(ChessType type) const;                         //整个棋盘上是否有连五
+
+private:
+    static int bit(int row, int col) { return row * STRIDE + col; }
+    static int word(int row, int col) { return bit(row, col) >> 6; }
+    static uint64_t mask(int row, int col) { return uint64_t(1) << (bit(row, col) & 63); }
+    static void shiftDown(const uint64_t* in, int shift, uint64_t* out);   //240位整体右移shift位
+
+    const uint64_t* side(ChessType type) const { return type == CHESS_BLACK ? black : white; }
+
+private:
+    uint64_t black[WORDS];
+    uint64_t white[WORDS];
+};
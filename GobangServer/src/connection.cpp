@@ -0,0 +1,182 @@
+#include "connection.h"
+#include "logger.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#define MAX_REGISTRY_FD 65536
+#define MAX_IOVECS 64
+
+
+size_t Connection::highWaterMark = 256 * 1024;
+int Connection::slowWatcherTimeoutMs = 5000;
+
+//fd -> 连接，所有线程共享
+static std::shared_ptr<Connection> registry[MAX_REGISTRY_FD];
+
+
+bool parseJsonFrame(const FrameView& frame, Json::Value& root) {
+    Json::Reader reader;
+    if (!reader.parse(frame.data, frame.data + frame.length, root))
+        return false;
+    LOG_TRACE("Recieved message: %.*s", int(frame.length), frame.data);
+    return true;
+}
+
+
+void Connection::add(const std::shared_ptr<Connection>& conn) {
+    if (conn->fd >= 0 && conn->fd < MAX_REGISTRY_FD)
+        std::atomic_store(&registry[conn->fd], conn);
+}
+
+void Connection::remove(SocketFD fd) {
+    if (fd >= 0 && fd < MAX_REGISTRY_FD)
+        std::atomic_store(&registry[fd], std::shared_ptr<Connection>());
+}
+
+std::shared_ptr<Connection> Connection::lookup(SocketFD fd) {
+    if (fd >= 0 && fd < MAX_REGISTRY_FD)
+        return std::atomic_load(&registry[fd]);
+    return std::shared_ptr<Connection>();
+}
+
+
+bool Connection::send(uint8_t kind, const std::shared_ptr<const std::string>& body) {
+    OutFrame frame;
+    frame.headerLength = encodeFrameHeader(frame.header, getFraming(), kind, body->length());
+    if (frame.headerLength == 0)
+        return false;
+    frame.body = body;
+    frame.offset = 0;
+
+    std::lock_guard<std::mutex> lock(outMutex);
+    if (writeFailed)
+        return false;
+
+    bool wasEmpty = outQueue.empty();
+    queuedBytes += frame.headerLength + body->length();
+    outQueue.push_back(std::move(frame));
+    //队列里原来就有数据，说明socket暂时不可写，等可写事件
+    if (wasEmpty)
+        flushLocked();
+    checkBackpressureLocked();
+    return !writeFailed;
+}
+
+void Connection::flush() {
+    std::lock_guard<std::mutex> lock(outMutex);
+    flushLocked();
+    checkBackpressureLocked();
+}
+
+size_t Connection::getQueuedBytes() {
+    std::lock_guard<std::mutex> lock(outMutex);
+    return queuedBytes;
+}
+
+std::string Connection::takeUnsent() {
+    std::lock_guard<std::mutex> lock(outMutex);
+    std::string bytes;
+    bytes.reserve(queuedBytes);
+    for (const OutFrame& frame : outQueue) {
+        std::string whole = std::string(frame.header, frame.headerLength) + *frame.body;
+        bytes.append(whole, frame.offset, std::string::npos);
+    }
+    outQueue.clear();
+    queuedBytes = 0;
+    return bytes;
+}
+
+//没有帧头，整段作为body，已经写出的部分从offset开始算
+void Connection::queueRaw(const std::string& bytes) {
+    if (bytes.empty())
+        return;
+    OutFrame frame;
+    frame.headerLength = 0;
+    frame.body = std::make_shared<const std::string>(bytes);
+    frame.offset = 0;
+
+    std::lock_guard<std::mutex> lock(outMutex);
+    queuedBytes += bytes.size();
+    outQueue.push_back(std::move(frame));
+    if (outQueue.size() == 1)
+        flushLocked();
+}
+
+void Connection::flushLocked() {
+    while (!outQueue.empty() && !writeFailed) {
+        //每一帧最多两个iovec：帧头和body
+        struct iovec vec[MAX_IOVECS];
+        int count = 0;
+        for (auto it = outQueue.begin(); it != outQueue.end() && count + 2 <= MAX_IOVECS; ++it) {
+            size_t offset = it->offset;
+            if (offset < it->headerLength) {
+                vec[count].iov_base = it->header + offset;
+                vec[count].iov_len = it->headerLength - offset;
+                ++count;
+                offset = 0;
+            }
+            else {
+                offset -= it->headerLength;
+            }
+            if (offset < it->body->length()) {
+                vec[count].iov_base = const_cast<char*>(it->body->data()) + offset;
+                vec[count].iov_len = it->body->length() - offset;
+                ++count;
+            }
+        }
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = vec;
+        msg.msg_iovlen = count;
+        //对方已经断开时不要触发SIGPIPE
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                writeFailed = true;
+            return;
+        }
+
+        //弹出已经完整写出的帧
+        size_t written = n;
+        queuedBytes -= written;
+        while (written > 0) {
+            OutFrame& front = outQueue.front();
+            size_t left = front.headerLength + front.body->length() - front.offset;
+            if (written < left) {
+                front.offset += written;
+                break;
+            }
+            written -= left;
+            outQueue.pop_front();
+        }
+    }
+}
+
+void Connection::checkBackpressureLocked() {
+    if (queuedBytes <= highWaterMark) {
+        overHighWater = false;
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (!overHighWater) {
+        overHighWater = true;
+        overHighWaterSince = now;
+        return;
+    }
+
+    //玩家不会因为慢被断开；观众持续超过高水位太久就断开，事件循环会读到连接关闭并让房间踢出他
+    if (getRole() == ROLE_WATCHER &&
+            now - overHighWaterSince > std::chrono::milliseconds(slowWatcherTimeoutMs)) {
+        LOG_WARN("Dropping slow watcher, fd: %d, queued bytes: %zu", fd, queuedBytes);
+        writeFailed = true;
+        outQueue.clear();
+        queuedBytes = 0;
+        shutdown(fd, SHUT_RDWR);
+    }
+}
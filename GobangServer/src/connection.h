@@ -0,0 +1,113 @@
+#pragma once
+
+#include "frame_decoder.h"
+#include "socket_func.h"
+#include "timer_wheel.h"
+#include "jsoncpp/json/json.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+
+bool parseJsonFrame(const FrameView& frame, Json::Value& root);   //把json帧解析到root
+
+class Room;
+
+
+//一个客户端连接，由事件循环持有。socket为非阻塞，收到的数据先放进解码器，再从中切出完整的消息；
+//要发送的帧先进入发送队列，用sendmsg把帧头和body作为分散的iovec一次写出，写不完的等可写事件再写
+class Connection {
+public:
+    enum Role {
+        ROLE_NONE = 0,      //还没有进入房间
+        ROLE_PLAYER = 1,    //玩家
+        ROLE_WATCHER = 2    //观众
+    };
+
+    explicit Connection(SocketFD fd, int loopIndex = 0)
+        : fd(fd), loopIndex(loopIndex), role(ROLE_NONE), framing(FRAMING_TEXT) {}
+
+public:
+    SocketFD getFd() const { return fd; }
+    int getLoopIndex() const { return loopIndex; }     //接收这个连接的事件循环，连接的状态只在那个线程中访问
+
+    int readAvailable() { return decoder.readFrom(fd); }   //见FrameDecoder::readFrom
+    int nextFrame(FrameView& frame) { return decoder.next(frame); } //取出一帧，见FrameDecoder::next
+
+    const std::shared_ptr<Room>& getRoom() const { return room; }
+    Role getRole() const { return Role(role.load()); }
+    void bind(const std::shared_ptr<Room>& roomIn, Role roleIn) { room = roomIn; role = roleIn; }
+    void setRole(Role roleIn) { role = roleIn; }       //中继的观众不在房间里，只标记身份，可以在任意线程调用
+
+    //连接上的定时器和最后一次收到消息的时间，只在事件循环线程中访问
+    TimerWheel::TimerId getTimer() const { return timer; }
+    void setTimer(TimerWheel::TimerId id) { timer = id; }
+    void touch() { lastActive = std::chrono::steady_clock::now(); received = true; }
+    bool hasReceived() const { return received; }
+    bool usesHeartbeat() const { return heartbeat; }
+    void enableHeartbeat() { heartbeat = true; }
+    std::chrono::steady_clock::time_point getLastActive() const { return lastActive; }
+
+    Framing getFraming() const { return Framing(framing.load(std::memory_order_relaxed)); }
+    void setFraming(Framing framingIn) { framing = framingIn; }
+
+    //任意线程都可以调用，不会阻塞：放进发送队列并尽量立即写出
+    bool send(uint8_t kind, const std::shared_ptr<const std::string>& body);
+    //socket可写时由事件循环调用
+    void flush();
+    size_t getQueuedBytes();
+
+    //热升级：旧进程取出还没写出的字节和还没解析的数据，新进程把它们原样放回
+    std::string takeUnsent();
+    void queueRaw(const std::string& bytes);
+    std::string unprocessedInput() const { return decoder.unprocessed(); }
+    void restoreInput(const std::string& bytes) { decoder.append(bytes.data(), bytes.size()); }
+
+    //按fd查找连接，发送消息的线程通过它找到发送队列
+    static void add(const std::shared_ptr<Connection>& conn);
+    static void remove(SocketFD fd);
+    static std::shared_ptr<Connection> lookup(SocketFD fd);
+
+    //发送队列超过高水位的观众，持续超过超时时间就会被断开
+    static void setHighWaterMark(size_t bytes) { highWaterMark = bytes; }
+    static void setSlowWatcherTimeout(int ms) { slowWatcherTimeoutMs = ms; }
+
+private:
+    struct OutFrame {
+        char header[MAX_HEADER_LENGTH];
+        size_t headerLength;
+        std::shared_ptr<const std::string> body;
+        size_t offset;      //已经写出的字节数，包括帧头
+    };
+
+    void flushLocked();
+    void checkBackpressureLocked();
+
+private:
+    SocketFD fd;
+    int loopIndex;
+    FrameDecoder decoder;                       //已接收但还没有解析的数据
+
+    std::shared_ptr<Room> room;                 //所在房间，只在事件循环线程中访问
+    std::atomic<int> role;                      //在房间中的身份
+    std::atomic<int> framing;                   //发送时使用的分帧方式
+
+    TimerWheel::TimerId timer = 0;              //握手或空闲超时
+    std::chrono::steady_clock::time_point lastActive;
+    bool received = false;                      //是否收到过消息
+    bool heartbeat = false;                     //客户端是否发过ping
+
+    std::mutex outMutex;
+    std::deque<OutFrame> outQueue;              //等待写出的帧
+    size_t queuedBytes = 0;
+    bool writeFailed = false;
+    bool overHighWater = false;
+    std::chrono::steady_clock::time_point overHighWaterSince;
+
+    static size_t highWaterMark;
+    static int slowWatcherTimeoutMs;
+};
@@ -0,0 +1,168 @@
+#include "event_loop.h"
+#include "logger.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#define MAX_EVENTS 128
+#define TIMER_TICK_MS 10
+
+
+EventLoop::EventLoop() :
+    quitFlag(false),
+    threadId(std::this_thread::get_id()),
+    timers(TIMER_TICK_MS),
+    startTime(std::chrono::steady_clock::now()),
+    numPending(0)
+{
+    epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollfd < 0)
+        LOG_ERROR("epoll_create error: %s(errno: %d)", strerror(errno), errno);
+
+    wakeupfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeupfd < 0)
+        LOG_ERROR("eventfd error: %s(errno: %d)", strerror(errno), errno);
+
+    addFd(wakeupfd, EPOLLIN | EPOLLET, [this](uint32_t){ handleWakeup(); });
+
+    timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerfd < 0)
+        LOG_ERROR("timerfd error: %s(errno: %d)", strerror(errno), errno);
+    else
+        addFd(timerfd, EPOLLIN | EPOLLET, [this](uint32_t){ handleTimer(); });
+}
+
+EventLoop::~EventLoop() {
+    if (timerfd >= 0)
+        close(timerfd);
+    if (wakeupfd >= 0)
+        close(wakeupfd);
+    if (epollfd >= 0)
+        close(epollfd);
+}
+
+bool EventLoop::addFd(int fd, uint32_t events, EventHandler handler) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        LOG_ERROR("epoll_ctl add error: %s(errno: %d)", strerror(errno), errno);
+        return false;
+    }
+    handlers[fd] = std::move(handler);
+    return true;
+}
+
+void EventLoop::removeFd(int fd) {
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, NULL);
+    handlers.erase(fd);
+}
+
+void EventLoop::loop() {
+    threadId = std::this_thread::get_id();
+    struct epoll_event events[MAX_EVENTS];
+
+    while (!quitFlag) {
+        int n = epoll_wait(epollfd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            LOG_ERROR("epoll_wait error: %s(errno: %d)", strerror(errno), errno);
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            //回调里可能注销了同一批次中的其他fd，所以每次都重新查找
+            auto it = handlers.find(events[i].data.fd);
+            if (it == handlers.end())
+                continue;
+            EventHandler handler = it->second;
+            handler(events[i].events);
+        }
+
+        doPendingFunctors();
+    }
+    quitFlag = false;
+}
+
+void EventLoop::quit() {
+    quitFlag = true;
+    //信号处理函数可能在事件循环线程中、epoll_wait之前执行，所以总是唤醒一次
+    wakeup();
+}
+
+void EventLoop::queueInLoop(Functor func) {
+    pendingFunctors.push(std::move(func));
+    numPending.fetch_add(1, std::memory_order_release);
+    wakeup();
+}
+
+void EventLoop::wakeup() {
+    uint64_t one = 1;
+    ssize_t n = write(wakeupfd, &one, sizeof(one));
+    (void)n;
+}
+
+void EventLoop::handleWakeup() {
+    uint64_t count = 0;
+    while (read(wakeupfd, &count, sizeof(count)) > 0) {}
+}
+
+//只执行开始时已经投递完的任务，任务中再投递的留到下一轮，和其他事件轮流执行
+void EventLoop::doPendingFunctors() {
+    size_t n = numPending.load(std::memory_order_acquire);
+    Functor func;
+    for (size_t i = 0; i < n && pendingFunctors.pop(func); ++i) {
+        numPending.fetch_sub(1, std::memory_order_relaxed);
+        func();
+    }
+}
+
+TimerWheel::TimerId EventLoop::runAfter(int delayMs, Functor func) {
+    //timerfd只在定时器到期时触发，平时时间轮落后于现在；先拨到现在，新定时器从现在开始计时，不会执行任何回调
+    timers.catchUp(elapsedMs());
+    TimerWheel::TimerId id = timers.add(delayMs, std::move(func));
+    armTimer();
+    return id;
+}
+
+void EventLoop::handleTimer() {
+    uint64_t expirations = 0;
+    while (read(timerfd, &expirations, sizeof(expirations)) > 0) {}
+
+    armedTick = TimerWheel::NO_TICK;
+    timers.advance(elapsedMs());
+    armTimer();
+}
+
+//定时器都在几秒之后时不再每个tick醒一次；被取消的定时器可能让timerfd空触发一次，到时重新设置即可
+void EventLoop::armTimer() {
+    if (timerfd < 0)
+        return;
+    uint64_t next = timers.nextTick();
+    if (next == armedTick)
+        return;
+
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (next != TimerWheel::NO_TICK) {
+        auto deadline = startTime + std::chrono::milliseconds(next * timers.getTickMs());
+        long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+        if (ns <= 0)
+            ns = 1;     //已经到期，全0会停掉timerfd
+        spec.it_value.tv_sec = ns / 1000000000LL;
+        spec.it_value.tv_nsec = ns % 1000000000LL;
+    }
+    timerfd_settime(timerfd, 0, &spec, NULL);
+    armedTick = next;
+}
+
+uint64_t EventLoop::elapsedMs() const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - startTime).count();
+}
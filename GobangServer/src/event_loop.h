@@ -0,0 +1,62 @@
+#pragma once
+
+#include "mailbox.h"
+#include "timer_wheel.h"
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <unordered_map>
+
+
+//基于epoll的事件循环(边缘触发)，由一个线程持有所有socket，socket就绪时回调对应的处理函数
+class EventLoop {
+public:
+    typedef std::function<void(uint32_t events)> EventHandler;
+    typedef std::function<void()> Functor;
+
+    EventLoop();
+    ~EventLoop();
+
+public:
+    bool addFd(int fd, uint32_t events, EventHandler handler);  //注册fd，events为EPOLLIN等
+    void removeFd(int fd);                                      //注销fd，不会关闭fd
+
+    void loop();                                                //进入事件循环，直到quit；返回后可以再次进入
+    void quit();                                                //退出事件循环，可在任意线程和信号处理函数中调用
+
+    void queueInLoop(Functor func);                             //把函数放到事件循环线程中执行，不加锁
+
+    //定时器在事件循环线程中执行，这两个函数也只能在事件循环线程中调用，其他线程先queueInLoop
+    TimerWheel::TimerId runAfter(int delayMs, Functor func);
+    bool cancelTimer(TimerWheel::TimerId id) { return timers.cancel(id); }
+    bool isInLoopThread() const { return threadId == std::this_thread::get_id(); }
+
+private:
+    void wakeup();
+    void handleWakeup();
+    void doPendingFunctors();
+    void handleTimer();
+    void armTimer();                                            //timerfd只在下一个定时器可能到期时触发一次，没有定时器时停掉
+    uint64_t elapsedMs() const;                                 //从startTime开始的毫秒数
+
+private:
+    int epollfd = -1;
+    int wakeupfd = -1;                                          //eventfd，用于唤醒epoll_wait
+    std::atomic<bool> quitFlag;
+    std::thread::id threadId;
+
+    std::unordered_map<int, EventHandler> handlers;             //fd -> 回调
+
+    TimerWheel timers;
+    int timerfd = -1;
+    uint64_t armedTick = TimerWheel::NO_TICK;                   //timerfd设置的tick
+    std::chrono::steady_clock::time_point startTime;            //时间轮从这里开始计时
+
+    Mailbox<Functor> pendingFunctors;                           //其他线程投递过来的任务
+    std::atomic<size_t> numPending;
+};
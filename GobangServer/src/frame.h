@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+//连接使用的分帧方式
+enum Framing {
+    FRAMING_TEXT = 0,       // |length:xxxx\n|body|   12字节的ASCII头，body最长9999字节
+    FRAMING_BINARY = 1      // |kind|varint length|body|   2~6字节的头
+};
+
+//二进制帧的类型，取值不能和文本帧的第一个字节'l'相同，这样同一个端口上可以混用两种分帧
+enum FrameKind {
+    FRAME_JSON = 0x01,      //body是json消息
+    FRAME_MOVE = 0x02,      //落子，body固定2字节：|格子下标 row*15+col|颜色 0黑 1白|
+    FRAME_PING = 0x03,      //心跳，body为空，客户端定时发送
+    FRAME_PONG = 0x04,      //心跳回应，body为空
+    FRAME_MOVE_LIST = 0x05  //已经下过的棋，每步一个字节 row*15+col，黑棋先手；观众中途加入时代替整个棋盘发送
+};
+
+#define TEXT_HEADER_LENGTH      12
+#define MAX_TEXT_BODY_LENGTH    9999
+#define MAX_HEADER_LENGTH       12
+#define MAX_VARINT_LENGTH       5
+#define MAX_BINARY_BODY_LENGTH  (64 << 10)     //协议里最大的消息(棋盘、落子顺序)远小于这个值，更长的帧头直接当作错误，不为它扩容
+#define MOVE_BODY_LENGTH        2
+
+
+bool isKnownFrameKind(uint8_t kind);
+
+//写入帧头，返回帧头长度，body太长无法编码时返回0
+size_t encodeFrameHeader(char* out, Framing framing, uint8_t kind, size_t bodyLength);
+
+//落子消息的编解码，chessType为-1(黑)或1(白)
+void encodeMove(char* out, int row, int col, int chessType);
+bool decodeMove(const char* data, size_t length, int& row, int& col, int& chessType);
+
+//解析varint，返回消耗的字节数，数据不够返回0，格式错误返回-1
+int decodeVarint(const uint8_t* data, size_t size, uint32_t& value);
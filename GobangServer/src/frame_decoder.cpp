@@ -0,0 +1,153 @@
+#include "frame_decoder.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+
+
+static size_t roundUpPowerOf2(size_t n) {
+    size_t cap = 1;
+    while (cap < n)
+        cap <<= 1;
+    return cap;
+}
+
+
+FrameDecoder::FrameDecoder(size_t initCapacity) :
+    buffer(roundUpPowerOf2(initCapacity))
+{
+}
+
+int FrameDecoder::readFrom(SocketFD fd) {
+    while (space() > 0) {
+        //空闲区域可能被缓冲区末尾分成两段，用readv一次读进去
+        size_t start = tail & mask();
+        size_t free = space();
+        size_t first = std::min(free, buffer.size() - start);
+        struct iovec vec[2];
+        vec[0].iov_base = &buffer[start];
+        vec[0].iov_len = first;
+        vec[1].iov_base = &buffer[0];
+        vec[1].iov_len = free - first;
+
+        ssize_t n = readv(fd, vec, vec[1].iov_len > 0 ? 2 : 1);
+        if (n > 0) {
+            tail += n;
+            continue;
+        }
+        if (n == 0)
+            return READ_CLOSED;
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return READ_DRAINED;
+        return READ_CLOSED;
+    }
+    return READ_FULL;
+}
+
+int FrameDecoder::next(FrameView& frame) {
+    head += pending;
+    pending = 0;
+
+    size_t headerLength = 0, msgLength = 0;
+    int ret = parseHeader(headerLength, msgLength, frame);
+    if (ret != FRAME_OK)
+        return ret;
+
+    size_t frameLength = headerLength + msgLength;
+    if (size() < frameLength) {
+        //整帧比缓冲区还大，扩容后才能读完
+        if (frameLength > buffer.size())
+            grow(frameLength);
+        return FRAME_NEED_MORE;
+    }
+
+    size_t start = (head + headerLength) & mask();
+    if (start + msgLength <= buffer.size()) {
+        frame.data = &buffer[start];
+    }
+    else {
+        scratch.resize(msgLength);
+        copyOut(head + headerLength, &scratch[0], msgLength);
+        frame.data = scratch.data();
+    }
+    frame.length = msgLength;
+    pending = frameLength;
+    return FRAME_OK;
+}
+
+int FrameDecoder::parseHeader(size_t& headerLength, size_t& bodyLength, FrameView& frame) const {
+    if (size() == 0)
+        return FRAME_NEED_MORE;
+
+    char header[MAX_HEADER_LENGTH + 1] = { 0 };
+    size_t peek = std::min(size(), size_t(MAX_HEADER_LENGTH));
+    copyOut(head, header, peek);
+
+    //文本帧 |length:xxxx\n|
+    if (header[0] == 'l') {
+        if (peek < TEXT_HEADER_LENGTH)
+            return FRAME_NEED_MORE;
+        int msgLength = 0;
+        if (memcmp(header, "length:", 7) != 0 ||
+                sscanf(header + 7, "%4d", &msgLength) != 1 || msgLength < 0)
+            return FRAME_BAD;
+        headerLength = TEXT_HEADER_LENGTH;
+        bodyLength = msgLength;
+        frame.kind = FRAME_JSON;
+        frame.framing = FRAMING_TEXT;
+        return FRAME_OK;
+    }
+
+    //二进制帧 |kind|varint length|
+    uint8_t kind = uint8_t(header[0]);
+    if (!isKnownFrameKind(kind))
+        return FRAME_BAD;
+    uint32_t msgLength = 0;
+    int n = decodeVarint((const uint8_t*)header + 1, peek - 1, msgLength);
+    if (n == 0)
+        return FRAME_NEED_MORE;
+    if (n < 0 || msgLength > MAX_BINARY_BODY_LENGTH)
+        return FRAME_BAD;
+    headerLength = 1 + n;
+    bodyLength = msgLength;
+    frame.kind = kind;
+    frame.framing = FRAMING_BINARY;
+    return FRAME_OK;
+}
+
+void FrameDecoder::copyOut(size_t pos, char* dst, size_t len) const {
+    size_t start = pos & mask();
+    size_t first = std::min(len, buffer.size() - start);
+    memcpy(dst, &buffer[start], first);
+    memcpy(dst + first, &buffer[0], len - first);
+}
+
+std::string FrameDecoder::unprocessed() const {
+    size_t start = head + pending;
+    std::string data(tail - start, '\0');
+    if (!data.empty())
+        copyOut(start, &data[0], data.size());
+    return data;
+}
+
+void FrameDecoder::append(const char* data, size_t length) {
+    if (space() < length)
+        grow(size() + length);
+    for (size_t i = 0; i < length; ++i)
+        buffer[(tail + i) & mask()] = data[i];
+    tail += length;
+}
+
+void FrameDecoder::grow(size_t minCapacity) {
+    std::vector<char> newBuffer(roundUpPowerOf2(minCapacity));
+    size_t used = size();
+    copyOut(head, newBuffer.data(), used);
+    buffer.swap(newBuffer);
+    head = 0;
+    tail = used;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "frame.h"
+#include "socket_func.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+
+//一帧消息在缓冲区中的视图，只在下一次调用next()或readFrom()之前有效
+struct FrameView {
+    const char* data = nullptr;
+    size_t length = 0;
+    uint8_t kind = FRAME_JSON;          //消息类型，文本帧总是FRAME_JSON
+    Framing framing = FRAMING_TEXT;     //这一帧使用的分帧方式
+};
+
+
+//每个连接一个的增量解码器：数据先读进环形缓冲区，短读时保留已收到的部分，
+//每次可就绪事件可以切出零到多帧，返回的是缓冲区内的视图，不拷贝。
+//文本帧和二进制帧按第一个字节区分，所以同一个连接上两种分帧都可以解析
+class FrameDecoder {
+public:
+    enum { READ_CLOSED = -1, READ_DRAINED = 0, READ_FULL = 1 };
+    enum { FRAME_BAD = -1, FRAME_NEED_MORE = 0, FRAME_OK = 1 };
+
+    explicit FrameDecoder(size_t initCapacity = 4096);
+
+public:
+    //非阻塞读到EAGAIN为止；READ_FULL表示缓冲区满了，处理完已有的帧后需要再读一次
+    int readFrom(SocketFD fd);
+    //取出下一帧，上一次返回的帧随之释放
+    int next(FrameView& frame);
+
+    size_t size() const { return tail - head; }                //缓冲区中未处理的字节数
+
+    //热升级时把还没有切出完整帧的数据交给新进程，新进程原样放回缓冲区
+    std::string unprocessed() const;
+    void append(const char* data, size_t length);
+
+private:
+    size_t space() const { return buffer.size() - size(); }
+    size_t mask() const { return buffer.size() - 1; }
+    void copyOut(size_t pos, char* dst, size_t len) const;      //从环形缓冲区拷贝，处理回绕
+    int parseHeader(size_t& headerLength, size_t& bodyLength, FrameView& frame) const;
+    void grow(size_t minCapacity);                              //扩容为2的幂，并把数据摆正
+
+private:
+    std::vector<char> buffer;   //容量总是2的幂
+    size_t head = 0;            //读位置，单调递增，取模后才是下标
+    size_t tail = 0;            //写位置
+    size_t pending = 0;         //上一次next()返回的帧占用的字节数，下一次next()时释放
+    std::string scratch;        //帧跨越缓冲区末尾时，拼成连续的一段
+};
@@ -0,0 +1,227 @@
+#include "game_log.h"
+#include "logger.h"
+#include "metrics.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+
+#define RECORD_VERSION      1
+#define RECORD_HEADER_SIZE  12
+#define MAX_NAME_LENGTH     255
+#define MAX_IDLE_SLEEP_MS   100         //没有记录时后台线程最长的休眠时间，也是最坏情况下记录落盘的延迟
+#define MAX_BATCH_IOV       64          //一次writev最多带的记录数
+
+
+/***********************
+ * Encoding
+***********************/
+static void putInt(std::string& out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i)
+        out.push_back(char((value >> (8 * i)) & 0xff));
+}
+
+static void putName(std::string& out, const std::string& name) {
+    size_t length = std::min(name.size(), size_t(MAX_NAME_LENGTH));
+    out.push_back(char(length));
+    out.append(name, 0, length);
+}
+
+static uint32_t crc32(const char* data, size_t length) {
+    static uint32_t table[256];
+    static bool ready = [](){
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)ready;
+
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = 0; i < length; ++i)
+        crc = table[(crc ^ uint8_t(data[i])) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffffu;
+}
+
+std::string GameLog::encode(const GameRecord& record) {
+    std::string body;
+    body.reserve(64 + record.moves.size());
+    putInt(body, uint32_t(record.roomId), 4);
+    putInt(body, uint64_t(record.startMs), 8);
+    putInt(body, uint64_t(record.endMs), 8);
+    body.push_back(char(int8_t(record.winner)));
+    putName(body, record.blackName);
+    putName(body, record.whiteName);
+    size_t numMoves = std::min(record.moves.size(), size_t(0xffff));
+    putInt(body, numMoves, 2);
+    body.append((const char*)record.moves.data(), numMoves);
+
+    std::string out;
+    out.reserve(RECORD_HEADER_SIZE + body.size());
+    out.push_back('G');
+    out.push_back('L');
+    out.push_back(char(RECORD_VERSION));
+    out.push_back(char(record.reason));
+    putInt(out, body.size(), 4);
+    putInt(out, crc32(body.data(), body.size()), 4);
+    out += body;
+    return out;
+}
+
+
+/***********************
+ * Writer
+***********************/
+bool GameLog::start(const std::string& dirIn, size_t segmentBytesIn) {
+    if (running)
+        return true;
+    dir = dirIn;
+    segmentBytes = std::max(segmentBytesIn, size_t(4096));
+    if (mkdir(dir.c_str(), 0755) == -1 && errno != EEXIST) {
+        LOG_ERROR("mkdir %s error: %s(errno: %d)", dir.c_str(), strerror(errno), errno);
+        return false;
+    }
+
+    //接着目录里最大的编号
+    segmentNo = 0;
+    DIR* d = opendir(dir.c_str());
+    if (d) {
+        struct dirent* entry;
+        while ((entry = readdir(d)) != NULL) {
+            unsigned no;
+            if (sscanf(entry->d_name, "games-%u.log", &no) == 1)
+                segmentNo = std::max(segmentNo, no);
+        }
+        closedir(d);
+    }
+    if (!openSegment())
+        return false;
+
+    running = true;
+    writer = std::thread([this](){ run(); });
+    return true;
+}
+
+void GameLog::stop() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        if (!running.exchange(false))
+            return;
+    }
+    wakeWriter.notify_one();
+    if (writer.joinable())
+        writer.join();
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+}
+
+void GameLog::append(const GameRecord& record) {
+    queue.push(encode(record));
+}
+
+//新建的文件要把目录也同步一下，否则崩溃后文件本身可能不见了
+bool GameLog::openSegment() {
+    if (fd >= 0)
+        close(fd);
+    char name[32];
+    snprintf(name, sizeof(name), "games-%08u.log", ++segmentNo);
+    std::string path = dir + "/" + name;
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("open game log %s error: %s(errno: %d)", path.c_str(), strerror(errno), errno);
+        return false;
+    }
+    written = 0;
+
+    int dirfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd >= 0) {
+        fsync(dirfd);
+        close(dirfd);
+    }
+    return true;
+}
+
+void GameLog::run() {
+    int sleepMs = 1;
+    while (running.load(std::memory_order_acquire)) {
+        //有记录时很快再来，空闲时逐渐延长休眠；休眠期间结束的对局在下一批一起提交
+        if (writeBatch() > 0)
+            sleepMs = 1;
+        else
+            sleepMs = std::min(sleepMs * 2, MAX_IDLE_SLEEP_MS);
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeWriter.wait_for(lock, std::chrono::milliseconds(sleepMs),
+                [this](){ return !running.load(std::memory_order_acquire); });
+    }
+    writeBatch();
+}
+
+size_t GameLog::writeBatch() {
+    static Counter& records = Metrics::counter("gobang_game_log_records_total", "Finished games written to the game log");
+    static Counter& syncs = Metrics::counter("gobang_game_log_syncs_total", "fdatasync calls made by the game log");
+
+    std::vector<std::string> batch;
+    std::string record;
+    while (queue.pop(record))
+        batch.push_back(std::move(record));
+    if (batch.empty() || fd < 0)
+        return batch.size();
+
+    //一段写满后换段，记录不跨段
+    for (size_t i = 0; i < batch.size(); ) {
+        if (written > 0 && written + batch[i].size() > segmentBytes) {
+            fdatasync(fd);
+            syncs.add();
+            if (!openSegment())
+                return batch.size();
+        }
+        struct iovec vec[MAX_BATCH_IOV];
+        size_t count = 0, bytes = 0;
+        while (i < batch.size() && count < MAX_BATCH_IOV &&
+                (count == 0 || written + bytes + batch[i].size() <= segmentBytes)) {
+            vec[count].iov_base = &batch[i][0];
+            vec[count].iov_len = batch[i].size();
+            bytes += batch[i].size();
+            ++count;
+            ++i;
+        }
+
+        //O_APPEND的普通文件一般一次写完，写不完时接着写剩下的
+        size_t done = 0;
+        while (done < bytes) {
+            ssize_t n = writev(fd, vec, int(count));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0) {
+                LOG_ERROR("write game log error: %s(errno: %d)", strerror(errno), errno);
+                return batch.size();
+            }
+            done += n;
+            for (size_t k = 0; k < count && n > 0; ++k) {
+                size_t used = std::min(size_t(n), vec[k].iov_len);
+                vec[k].iov_base = (char*)vec[k].iov_base + used;
+                vec[k].iov_len -= used;
+                n -= used;
+            }
+        }
+        written += bytes;
+    }
+
+    fdatasync(fd);
+    syncs.add();
+    records.add(batch.size());
+    return batch.size();
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "mailbox.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define DEFAULT_SEGMENT_BYTES   (64u << 20)     //一个段文件写到这么大就换下一个
+
+
+//一局结束时的记录，落子按顺序每步一个字节(row * 15 + col)，黑棋先手，颜色由顺序决定
+struct GameRecord {
+    enum Reason {
+        REASON_FIVE = 1,            //连五
+        REASON_DRAW = 2,            //下满
+        REASON_TIMEOUT = 3,         //超时
+        REASON_DISCONNECT = 4,      //一方离开
+        REASON_SHUTDOWN = 5         //服务器关闭
+    };
+
+    int roomId = -1;
+    std::string blackName;
+    std::string whiteName;
+    int64_t startMs = 0;            //unix时间，毫秒
+    int64_t endMs = 0;
+    int winner = 0;                 //CHESS_BLACK、CHESS_WHITE，和棋或者没有结果时为0
+    Reason reason = REASON_FIVE;
+    std::vector<uint8_t> moves;
+};
+
+//只追加的对局日志，写满一段换一个文件：dir/games-00000001.log ...
+//每条记录：|magic 'G' 'L'|版本|原因|内容长度 u32|crc32 u32|内容|，数字都是小端。
+//  内容：|房间号 i32|开始 i64|结束 i64|胜方 i8|黑方名字长度 u8|名字|白方名字长度 u8|名字|步数 u16|每步一个字节|
+//房间线程把编码好的记录放进无锁队列就返回；后台线程把攒下的记录一次写出，只调用一次fdatasync(组提交)。
+//崩溃时最后一条可能只写了一半，读的时候按crc丢掉
+class GameLog {
+public:
+    GameLog() {}
+    ~GameLog() { stop(); }
+    GameLog(const GameLog&) = delete;
+    GameLog& operator=(const GameLog&) = delete;
+
+public:
+    //每次启动都开一个新的段，编号接着目录里已有的最大编号
+    bool start(const std::string& dir, size_t segmentBytes = DEFAULT_SEGMENT_BYTES);
+    void stop();                                    //写完队列里剩下的记录，停止后台线程
+    bool isRunning() const { return running.load(std::memory_order_acquire); }
+
+    void append(const GameRecord& record);          //任意线程调用，不阻塞
+
+    static std::string encode(const GameRecord& record);
+
+private:
+    void run();
+    size_t writeBatch();                            //写出队列里的所有记录并同步到磁盘，返回条数
+    bool openSegment();
+
+private:
+    Mailbox<std::string> queue;
+    std::atomic<bool> running{false};
+    std::thread writer;
+    std::mutex sleepMutex;
+    std::condition_variable wakeWriter;             //stop时叫醒休眠中的后台线程
+
+    std::string dir;
+    size_t segmentBytes = DEFAULT_SEGMENT_BYTES;
+    unsigned segmentNo = 0;
+    int fd = -1;
+    size_t written = 0;                             //当前段已经写的字节数
+};
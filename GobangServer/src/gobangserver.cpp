@@ -1,18 +1,28 @@
 #include "gobangserver.h"
 
 #include "api.h"
+#include "logger.h"
+#include "metrics.h"
+#include "upgrade.h"
 
 #include <stdlib.h>
 #include <string.h>
 
 #include <algorithm>
 #include <chrono>
-#include <iostream>
+#include <functional>
 #include <random>
 
 
+static const int HOT_ROOMS_REPORTED = 10;    //指标里最多列出多少个积压的房间
+
+
 GobangServer::GobangServer() :
-    pool(10)
+    //所有房间共享一个线程池，大小和CPU核数一致
+    pool(std::max(1u, std::thread::hardware_concurrency())),
+    numLoops(int(std::max(1u, std::thread::hardware_concurrency()))),
+    isRunning(true),
+    pendingShutdowns(0)
 {
 #ifdef WIN32
         WORD sockVersion = MAKEWORD(2, 2);
@@ -20,214 +30,888 @@ GobangServer::GobangServer() :
         WSAStartup(sockVersion, &wsaData);
 #endif
 
-    pool.enqueue([this](){
-        while (isRunning) {
-            std::cout << "Rooms in use: " << rooms.size() << std::endl;
-            for (auto it = rooms.begin(); it != rooms.end(); ) {
-                if ((*it)->shouldDelete()) {
-                    std::cout << "Deleting room: " << (*it)->getId() << std::endl;                
-                    delete (*it);
-                    it = rooms.erase(it);
-                }
-                else {
-                    ++it;
-                }
-            }
-
-            if (rooms.size() == 0)
-                std::this_thread::sleep_for(std::chrono::seconds(5));
-            else
-                std::this_thread::sleep_for(std::chrono::seconds(1));
+    //这两个值本来就有，抓取时再读
+    Metrics::gaugeFunc("gobang_rooms", "Rooms in use", [this](){ return double(rooms.size()); });
+    Metrics::gaugeFunc("gobang_thread_pool_queue_depth", "Tasks waiting in the shared thread pool",
+            [this](){ return double(pool.queueSize()); });
+    //任务积压最多的几个房间，看哪些房间最忙；只列出有积压的，标签不会随房间数增长
+    Metrics::gaugesFunc("gobang_room_queue_depth", "Tasks waiting in the busiest rooms", [this](){
+        std::vector< std::pair<size_t, int> > depths;
+        for (auto& room : rooms.snapshot()) {
+            size_t depth = room->getQueueDepth();
+            if (depth > 0)
+                depths.emplace_back(depth, room->getId());
         }
+        size_t count = std::min(depths.size(), size_t(HOT_ROOMS_REPORTED));
+        std::partial_sort(depths.begin(), depths.begin() + count, depths.end(),
+                std::greater< std::pair<size_t, int> >());
+
+        Metrics::LabelledValues values;
+        for (size_t i = 0; i < count; ++i)
+            values.emplace_back("room=\"" + std::to_string(depths[i].second) + "\"", double(depths[i].first));
+        return values;
     });
 }
 
+static Gauge& connectionsGauge() {
+    static Gauge& gauge = Metrics::gauge("gobang_connections", "Open client connections");
+    return gauge;
+}
+
+static const int DRAIN_CHECK_MS = 10;      //关闭时多久检查一次发送队列
+
+static Counter& timeoutCounter(const char* kind) {
+    return Metrics::counter("gobang_timeouts_total", "Connections closed or games ended by a timeout",
+            std::string("kind=\"") + kind + "\"");
+}
+
 
+//只让事件循环退出，关闭的过程在start中事件循环退出后执行
 void GobangServer::stop() {
-    std::cout << "\nStopping server" << std::endl;
-    shutdown(socketfd, 2);
-    std::this_thread::sleep_for(std::chrono::seconds(1));
-    std::cout << "Closing socket" << std::endl;
-    closeSocket(socketfd);
+    for (auto& shard : shards)
+        shard->loop.quit();
+}
+
+void GobangServer::runLoops() {
+    for (size_t i = 1; i < shards.size(); ++i) {
+        LoopShard* shard = shards[i].get();
+        shard->thread = std::thread([shard](){ shard->loop.loop(); });
+    }
+    shards[0]->loop.loop();
+    for (size_t i = 1; i < shards.size(); ++i)
+        shards[i]->thread.join();
+}
+
+//停止接收新连接，通知所有房间，在期限内把发送队列写完，然后结束工作线程，关闭连接，释放所有房间
+void GobangServer::drain() {
+    auto begin = std::chrono::steady_clock::now();
+    size_t numConnections = 0;
+    for (auto& shard : shards)
+        numConnections += shard->connections.size();
+    LOG_INFO("Stopping server, %zu connections, %zu rooms", numConnections, rooms.size());
     isRunning = false;
-    std::this_thread::sleep_for(std::chrono::seconds(2));
-    std::cout << "Quit successfully" << std::endl;
+    admin.stop();
+    if (upgradefd >= 0) {
+        shards[0]->loop.removeFd(upgradefd);
+        closeSocket(upgradefd);
+        unlink(upgradePath.c_str());
+    }
+
+    //所有事件循环都已经退出，下面直接访问各自的连接
+    draining = true;
+    Packet notice = API::packServerShutdown();
+    for (auto& shard : shards) {
+        shard->loop.removeFd(shard->listenfd);
+        closeSocket(shard->listenfd);
+        //房间里的连接由房间通知，保证排在房间已经在处理的消息之后
+        for (auto& item : shard->connections) {
+            if (!item.second->getRoom())
+                sendPacket(notice, item.first);
+        }
+    }
+    for (auto& room : rooms.snapshot()) {
+        ++pendingShutdowns;
+        room->post([this, r = room.get()](){
+            r->shutdown();
+            --pendingShutdowns;
+        });
+    }
+
+    //事件循环继续处理可写事件，直到写完或超时；期间再次调用stop会直接退出
+    drainDeadline = begin + std::chrono::milliseconds(drainTimeoutMs);
+    for (auto& shard : shards) {
+        LoopShard* s = shard.get();
+        s->loop.queueInLoop([this, s](){ checkDrained(*s); });
+    }
+    runLoops();
+
+    if (relay)
+        relay->stop();
+    pool.shutdown();
+    gameLog.stop();
+    closeConnections(true);
+    rooms.clear();
+    //对局都已经结束并通知过了，下次启动不需要恢复
+    store.clear();
+
+    LOG_INFO("Quit successfully in %lld ms", (long long)std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - begin).count());
 }
 
+//halfClose时对方先收到FIN，再关闭socket；已经交给新进程的socket不能shutdown，只关闭自己这一份
+void GobangServer::closeConnections(bool halfClose) {
+    for (auto& shard : shards) {
+        for (auto& item : shard->connections) {
+            shard->loop.removeFd(item.first);
+            shard->loop.cancelTimer(item.second->getTimer());
+            Connection::remove(item.first);
+            if (halfClose)
+                ::shutdown(item.first, SHUT_WR);
+            closeSocket(item.first);
+        }
+        connectionsGauge().sub(shard->connections.size());
+        shard->connections.clear();
+    }
+}
 
-bool GobangServer::start(int port) {
-    socketfd = socket(AF_INET, SOCK_STREAM, 0); //创建套接字，用于监听
-    if (socketfd <= 0) {
-        printf("create socket error: %s(errno: %d)\n", strerror(errno), errno);
-        return false;
+//同一时间只交接给一个新进程，后来的连接直接关闭
+void GobangServer::handleUpgradeRequest() {
+    SocketFD fd;
+    while ((fd = accept4(upgradefd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+        if (handoverChannel >= 0 || !isRunning) {
+            closeSocket(fd);
+            continue;
+        }
+        LOG_INFO("New process connected on %s, handing over", upgradePath.c_str());
+        handoverChannel = fd;
+        stop();
+    }
+}
+
+//事件循环都已经退出，等房间里排队的任务执行完，房间的状态不会再变，然后把所有状态交给新进程。
+//还没写出的数据和还没解析完的半帧也一起交过去，客户端看到的字节流是连续的
+void GobangServer::handover() {
+    auto begin = std::chrono::steady_clock::now();
+    isRunning = false;
+    admin.stop();
+    shards[0]->loop.removeFd(upgradefd);
+    closeSocket(upgradefd);
+    pool.shutdown();
+    //新进程收到状态后才打开对局日志，从下一段开始写
+    gameLog.stop();
+
+    Json::Value state;
+    std::vector<int> fds;
+    Json::Value listeners(Json::arrayValue);
+    for (auto& shard : shards) {
+        listeners.append(shard->listenfd);
+        fds.push_back(shard->listenfd);
+    }
+    state["listeners"] = listeners;
+
+    Json::Value connectionList(Json::arrayValue);
+    for (auto& shard : shards) {
+        for (auto& item : shard->connections) {
+            Connection* conn = item.second.get();
+            Json::Value c;
+            c["fd"] = item.first;
+            c["room"] = conn->getRoom() ? conn->getRoom()->getId() : -1;
+            c["framing"] = conn->getFraming();
+            c["heartbeat"] = conn->usesHeartbeat();
+            c["received"] = conn->hasReceived();
+            c["input"] = Upgrade::toHex(conn->unprocessedInput());
+            c["unsent"] = Upgrade::toHex(conn->takeUnsent());
+            connectionList.append(c);
+            fds.push_back(item.first);
+        }
+    }
+    state["connections"] = connectionList;
+
+    //最后一名玩家已经退出、还没来得及回收的房间不交接
+    Json::Value roomList(Json::arrayValue);
+    for (auto& room : rooms.snapshot()) {
+        if (!room->shouldDelete())
+            roomList.append(room->snapshot());
+    }
+    state["rooms"] = roomList;
+
+    Json::Value fdList(Json::arrayValue);
+    for (int fd : fds)
+        fdList.append(fd);
+    state["fds"] = fdList;
+
+    bool ok = Upgrade::sendState(handoverChannel, state, fds) && Upgrade::waitAck(handoverChannel);
+    closeSocket(handoverChannel);
+    if (ok)
+        LOG_INFO("Handed over %u connections and %u rooms in %lld ms", connectionList.size(), roomList.size(),
+                (long long)std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - begin).count());
+    else
+        LOG_ERROR("Upgrade failed, closing all connections");
+
+    for (auto& shard : shards) {
+        shard->loop.removeFd(shard->listenfd);
+        closeSocket(shard->listenfd);
+    }
+    closeConnections(false);
+    rooms.clear();
+}
+
+//玩家和观众以房间里的名单为准：加入失败还没来得及解绑的连接不在名单里，恢复成不在房间
+void GobangServer::restoreState(const Json::Value& state, const std::unordered_map<int, SocketFD>& fds) {
+    std::unordered_map< SocketFD, std::pair<std::shared_ptr<Room>, Connection::Role> > members;
+    for (const Json::Value& r : state["rooms"]) {
+        int id = r["id"].asInt();
+        std::shared_ptr<Room> room = std::make_shared<Room>(pool);
+        if (!rooms.insert(id, room)) {
+            LOG_WARN("Cannot restore room %d", id);
+            continue;
+        }
+        setupRoom(room);
+        room->restore(r, fds);
+        if (room->getNumReserved() > 0)
+            expireReservedLater(room);
+
+        for (const Json::Value& p : r["players"]) {
+            auto it = fds.find(p["fd"].asInt());
+            if (it != fds.end())
+                members[it->second] = std::make_pair(room, Connection::ROLE_PLAYER);
+        }
+        for (const Json::Value& w : r["watchers"]) {
+            auto it = fds.find(w["fd"].asInt());
+            if (it != fds.end())
+                members[it->second] = std::make_pair(room, Connection::ROLE_WATCHER);
+        }
     }
 
+    //连接轮流分给各个事件循环
+    size_t next = 0;
+    for (const Json::Value& c : state["connections"]) {
+        auto it = fds.find(c["fd"].asInt());
+        if (it == fds.end())
+            continue;
+        SocketFD fd = it->second;
+        auto member = members.find(fd);
+
+        //房间已经回收、还没来得及关闭的观众，和回收房间时一样关闭
+        if (member == members.end() && c["room"].asInt() >= 0 && !rooms.find(c["room"].asInt())) {
+            closeSocket(fd);
+            continue;
+        }
+
+        LoopShard& shard = *shards[next++ % shards.size()];
+        std::shared_ptr<Connection> conn = std::make_shared<Connection>(fd, shard.index);
+        conn->setFraming(Framing(c["framing"].asInt()));
+        if (c["heartbeat"].asBool())
+            conn->enableHeartbeat();
+        if (c["received"].asBool())
+            conn->touch();
+        if (member != members.end())
+            conn->bind(member->second.first, member->second.second);
+        conn->restoreInput(Upgrade::fromHex(c["input"].asString()));
+        conn->queueRaw(Upgrade::fromHex(c["unsent"].asString()));
+        addConnection(shard, conn);
+    }
+}
+
+//上次是正常关闭或者热升级交接时，文件里没有房间。写到一半的槽位丢掉
+void GobangServer::recoverRooms() {
+    auto begin = std::chrono::steady_clock::now();
+    size_t torn = store.forEach([this](const RoomRecord& record){
+        std::shared_ptr<Room> room = std::make_shared<Room>(pool);
+        if (record.numSeats == 0 || !rooms.insert(record.id, room)) {
+            store.erase(record.id);
+            return;
+        }
+        setupRoom(room);
+        room->recover(record);
+        expireReservedLater(room);
+    });
+    if (torn > 0)
+        LOG_WARN("Discarded %zu rooms that were being written when the server stopped", torn);
+    if (rooms.size() > 0)
+        LOG_INFO("Recovered %zu rooms from %s in %lld ms", rooms.size(), stateFile.c_str(),
+                (long long)std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - begin).count());
+}
+
+//只持有弱引用，房间已经回收时什么都不做
+void GobangServer::expireReservedLater(const std::shared_ptr<Room>& room) {
+    if (rejoinTimeoutMs <= 0)
+        return;
+    std::weak_ptr<Room> weak = room;
+    EventLoop* loop = &homeOf(room->getId()).loop;
+    int timeout = rejoinTimeoutMs;
+    loop->queueInLoop([loop, timeout, weak](){
+        loop->runAfter(timeout, [weak](){
+            std::shared_ptr<Room> r = weak.lock();
+            if (r)
+                r->post([p = r.get()](){ p->expireReserved(); });
+        });
+    });
+}
+
+void GobangServer::checkDrained(LoopShard& shard) {
+    bool done = pendingShutdowns == 0;
+    for (auto it = shard.connections.begin(); done && it != shard.connections.end(); ++it)
+        done = it->second->getQueuedBytes() == 0;
+
+    if (!done && std::chrono::steady_clock::now() >= drainDeadline) {
+        LOG_WARN("Drain timed out, %d rooms not notified", pendingShutdowns.load());
+        done = true;
+    }
+    if (done)
+        shard.loop.quit();
+    else
+        shard.loop.runAfter(DRAIN_CHECK_MS, [this, &shard](){ checkDrained(shard); });
+}
+
+
+SocketFD GobangServer::openListener(int port, bool reusePort) {
+    SocketFD fd = socket(AF_INET, SOCK_STREAM, 0); //创建套接字，用于监听
+    if (fd < 0) {
+        LOG_ERROR("create socket error: %s(errno: %d)", strerror(errno), errno);
+        return -1;
+    }
+
+    //重启时不用等TIME_WAIT的连接过期
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#ifdef SO_REUSEPORT
+    if (reusePort && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+        LOG_ERROR("SO_REUSEPORT error: %s(errno: %d)", strerror(errno), errno);
+        closeSocket(fd);
+        return -1;
+    }
+#endif
+
     //IP和端口
     struct sockaddr_in servaddr;
+    memset(&servaddr, 0, sizeof(servaddr));
     servaddr.sin_family = AF_INET;
     servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
     servaddr.sin_port = htons(port);
 
     //绑定网卡
-    if (bind(socketfd, (struct sockaddr*)&servaddr, sizeof(servaddr)) == -1) {
-        printf("bind socket error: %s(errno: %d)\n", strerror(errno), errno);
-        closeSocket(socketfd);
-        return false;
+    if (bind(fd, (struct sockaddr*)&servaddr, sizeof(servaddr)) == -1) {
+        LOG_ERROR("bind socket error: %s(errno: %d)", strerror(errno), errno);
+        closeSocket(fd);
+        return -1;
     }
 
     //监听端口
-    if (listen(socketfd, 10) == -1) {
-        printf("listen socket error: %s(errno: %d)\n", strerror(errno), errno);
-        closeSocket(socketfd);
+    if (listen(fd, backlog) == -1) {
+        LOG_ERROR("listen socket error: %s(errno: %d)", strerror(errno), errno);
+        closeSocket(fd);
+        return -1;
+    }
+
+    setNonBlocking(fd);
+    return fd;
+}
+
+bool GobangServer::start(int port) {
+#ifndef SO_REUSEPORT
+    numLoops = 1;
+#endif
+    //中继的上游连接交不出去，不支持热升级
+    if (relayPort > 0 && !upgradePath.empty()) {
+        LOG_WARN("Hot upgrade is not supported in relay mode, ignoring the upgrade socket");
+        upgradePath.clear();
+    }
+    //旧进程在升级socket上等待时，接管它的监听socket、连接和房间，事件循环的个数和旧进程一样
+    Json::Value state;
+    std::unordered_map<int, SocketFD> inherited;
+    SocketFD channel = upgradePath.empty() ? -1 : Upgrade::connectTo(upgradePath);
+    if (channel >= 0) {
+        std::vector<int> fds;
+        bool ok = Upgrade::recvState(channel, state, fds) && state["fds"].size() == fds.size();
+        for (size_t i = 0; i < fds.size(); ++i) {
+            if (ok)
+                inherited[state["fds"][Json::ArrayIndex(i)].asInt()] = fds[i];
+            else
+                closeSocket(fds[i]);
+        }
+        if (!ok) {
+            LOG_ERROR("Failed to receive state from the old process");
+            closeSocket(channel);
+            return false;
+        }
+        numLoops = std::max(1, int(state["listeners"].size()));
+    }
+
+    //热升级时两个进程映射同一个状态文件，旧进程交接之前不会再写
+    if ((!stateFile.empty() && !store.open(stateFile, rooms.getMinId(), rooms.getMaxId())) ||
+            (!gameLogDir.empty() && !gameLog.start(gameLogDir, gameLogSegmentBytes))) {
+        for (auto& item : inherited)
+            closeSocket(item.second);
+        if (channel >= 0)
+            closeSocket(channel);
         return false;
     }
 
-    printf("Running...\n");
-    
+    for (int i = 0; i < numLoops; ++i)
+        shards.emplace_back(new LoopShard(i));
+
+    //订阅按房间号分给事件循环，和房间一样
+    if (relayPort > 0) {
+        relay.reset(new Relay(relayHost, relayPort,
+                    [this](int roomId){ return &homeOf(roomId).loop; },
+                    [this](SocketFD fd){ closeRelayWatcher(fd); }));
+        if (!relay->start())
+            return false;
+    }
+
+    //每个事件循环一个监听socket，内核按连接的四元组分给它们，接收不再集中在一个线程
+    for (auto& shard : shards) {
+        if (channel >= 0) {
+            auto it = inherited.find(state["listeners"][Json::ArrayIndex(shard->index)].asInt());
+            shard->listenfd = it != inherited.end() ? it->second : -1;
+        }
+        else
+            shard->listenfd = openListener(port, numLoops > 1);
+        if (shard->listenfd < 0) {
+            for (auto& opened : shards) {
+                if (opened->listenfd >= 0)
+                    closeSocket(opened->listenfd);
+            }
+            return false;
+        }
+        LoopShard* s = shard.get();
+        s->loop.addFd(s->listenfd, EPOLLIN | EPOLLET, [this, s](uint32_t){ handleAccept(*s); });
+    }
+
+    if (channel >= 0) {
+        restoreState(state, inherited);
+        Upgrade::sendAck(channel);
+        closeSocket(channel);
+        LOG_INFO("Took over %u connections and %zu rooms from the old process",
+                state["connections"].size(), rooms.size());
+    }
+    else if (store.isOpen()) {
+        recoverRooms();
+    }
+    if (!upgradePath.empty()) {
+        upgradefd = Upgrade::listenOn(upgradePath);
+        if (upgradefd >= 0)
+            shards[0]->loop.addFd(upgradefd, EPOLLIN | EPOLLET, [this](uint32_t){ handleUpgradeRequest(); });
+    }
+
+    LOG_INFO("Running on port %d with %d event loops", port, numLoops);
+    if (adminPort > 0)
+        admin.start(adminPort);
+    //所有连接都由事件循环处理，不再为每个连接占用一个线程
+    runLoops();
+    if (handoverChannel >= 0)
+        handover();
+    else
+        drain();
+
+    return true;
+}
+
+void GobangServer::handleAccept(LoopShard& shard) {
+    //边缘触发，一次把所有等待的连接都接收完
     while (isRunning) {
-        SocketFD connectfd = 0;
-        //接收连接
-        if ((connectfd = accept(socketfd, (struct sockaddr*)NULL, NULL)) <= 0) {
-            printf("accept socket error %s(errno: %d)\n", strerror(errno), errno);
-            continue;
+        SocketFD connectfd = accept4(shard.listenfd, (struct sockaddr*)NULL, NULL, SOCK_NONBLOCK);
+        if (connectfd < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                LOG_ERROR("accept socket error %s(errno: %d)", strerror(errno), errno);
+            break;
         }
 
-        printf("Accept one connection.\n");
+        LOG_DEBUG("Accept one connection, fd: %d, loop: %d", connectfd, shard.index);
 
-        //封装一下，放进线程池，通知一个线程来执行匿名函数，解析请求
-        pool.enqueue([this, connectfd](){
-            Json::Value root;
-            int ret = recvJsonMsg(root, connectfd);//接收消息
-            std::cout << "Recv Ret: " << ret << std::endl;;
+        //不发心跳的老客户端靠TCP keepalive发现断网
+        if (keepAliveIdleSec > 0)
+            setKeepAlive(connectfd, keepAliveIdleSec);
+        addConnection(shard, std::make_shared<Connection>(connectfd, shard.index));
+    }
+}
 
-            if (ret == -1) {
-                closeSocket(connectfd);//接收失败就关闭客户端
-                return;
-            }
-            else if (ret > 0){
-                parseJsonMsg(root, connectfd);//解析消息
-            }
+void GobangServer::addConnection(LoopShard& shard, const std::shared_ptr<Connection>& conn) {
+    SocketFD fd = conn->getFd();
+    shard.connections[fd] = conn;
+    Connection::add(conn);
+    connectionsGauge().add();
+    //同时关注可写事件，发送队列中写不完的数据在socket可写时继续写
+    LoopShard* s = &shard;
+    shard.loop.addFd(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, [this, s, fd](uint32_t events){
+        if (events & EPOLLOUT)
+            handleWrite(*s, fd);
+        if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            handleRead(*s, fd);
+    });
+
+    //连上之后一直不发消息的连接要在握手超时后断开，收到过消息的连接到时按空闲时间重新计算
+    int timeout = handshakeTimeoutMs > 0 ? handshakeTimeoutMs : idleTimeoutMs;
+    if (timeout > 0)
+        conn->setTimer(shard.loop.runAfter(timeout, [this, s, fd](){ handleConnectionTimer(*s, fd); }));
+}
+
+//每个连接只有一个定时器：先做握手检查，之后按最后收到消息的时间顺延，做空闲检查。
+//观众只接收不发送，不做空闲检查；玩家在对局中由每步的时限约束
+void GobangServer::handleConnectionTimer(LoopShard& shard, SocketFD fd) {
+    auto it = shard.connections.find(fd);
+    if (it == shard.connections.end())
+        return;
+    Connection* conn = it->second.get();
+    conn->setTimer(0);
+
+    if (!conn->hasReceived()) {
+        static Counter& handshakeTimeouts = timeoutCounter("handshake");
+        handshakeTimeouts.add();
+        LOG_INFO("Closing fd %d: no message within %d ms", fd, handshakeTimeoutMs);
+        handleClose(shard, fd);
+        return;
+    }
+
+    long long idle = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - conn->getLastActive()).count();
+    long long next = -1;
+
+    //发过心跳的客户端会定时发ping，连续几个周期什么都没收到说明对方已经断网，不用等TCP超时
+    int heartbeatTimeoutMs = heartbeatIntervalMs * heartbeatMissCount;
+    if (conn->usesHeartbeat() && heartbeatTimeoutMs > 0) {
+        if (idle >= heartbeatTimeoutMs) {
+            static Counter& heartbeatTimeouts = timeoutCounter("heartbeat");
+            heartbeatTimeouts.add();
+            LOG_INFO("Closing fd %d: no heartbeat for %lld ms", fd, idle);
+            handleClose(shard, fd);
+            return;
+        }
+        next = heartbeatTimeoutMs - idle;
+    }
+
+    if (idleTimeoutMs > 0 && conn->getRole() != Connection::ROLE_WATCHER) {
+        if (idle >= idleTimeoutMs) {
+            static Counter& idleTimeouts = timeoutCounter("idle");
+            idleTimeouts.add();
+            LOG_INFO("Closing fd %d: idle for %lld ms", fd, idle);
+            handleClose(shard, fd);
+            return;
+        }
+        if (next < 0 || idleTimeoutMs - idle < next)
+            next = idleTimeoutMs - idle;
+    }
+
+    if (next >= 0)
+        conn->setTimer(shard.loop.runAfter(int(next), [this, &shard, fd](){ handleConnectionTimer(shard, fd); }));
+}
+
+void GobangServer::handleWrite(LoopShard& shard, SocketFD fd) {
+    auto it = shard.connections.find(fd);
+    if (it != shard.connections.end())
+        it->second->flush();
+}
+
+void GobangServer::handleRead(LoopShard& shard, SocketFD fd) {
+    auto it = shard.connections.find(fd);
+    if (it == shard.connections.end())
+        return;
+    Connection* conn = it->second.get();
+
+    bool closed = false;
+    bool more = true;
+    while (more && !closed) {
+        int readRet = conn->readAvailable();
+        closed = (readRet == FrameDecoder::READ_CLOSED);
+        //缓冲区满了，处理完已有的消息后继续读
+        more = (readRet == FrameDecoder::READ_FULL);
+
+        //先把已经收到的完整消息处理完
+        FrameView frame;
+        int ret;
+        while ((ret = conn->nextFrame(frame)) == FrameDecoder::FRAME_OK) {
+            conn->touch();
+            dispatchFrame(shard, conn, frame);
+        }
+        //消息头错误，后面的数据无法再解析
+        if (ret == FrameDecoder::FRAME_BAD)
+            closed = true;
+    }
+
+    if (closed)
+        handleClose(shard, fd);
+}
+
+void GobangServer::dispatchFrame(LoopShard& shard, Connection* conn, const FrameView& frame) {
+    SocketFD fd = conn->getFd();
+    Room* room = conn->getRoom().get();
+    auto receivedAt = std::chrono::steady_clock::now();
+
+    //正在关闭，房间已经结束对局，不再处理新消息
+    if (draining)
+        return;
+
+    //心跳：第一次收到ping后这个连接开始按心跳判断是否断开
+    if (frame.kind == FRAME_PING) {
+        static const std::shared_ptr<const std::string> emptyBody = std::make_shared<const std::string>();
+        conn->send(FRAME_PONG, emptyBody);
+        if (!conn->usesHeartbeat() && heartbeatIntervalMs > 0) {
+            conn->enableHeartbeat();
+            shard.loop.cancelTimer(conn->getTimer());
+            conn->setTimer(shard.loop.runAfter(heartbeatIntervalMs * heartbeatMissCount,
+                        [this, &shard, fd](){ handleConnectionTimer(shard, fd); }));
+        }
+        return;
+    }
+    if (frame.kind == FRAME_PONG)
+        return;
+
+    //二进制落子消息，只有玩家可以发送
+    if (frame.kind == FRAME_MOVE) {
+        MessageStats::received(MessageStats::move(), frame.length);
+        int row, col, chessType;
+        if (!room || conn->getRole() != Connection::ROLE_PLAYER ||
+                !decodeMove(frame.data, frame.length, row, col, chessType))
+            return;
+        room->post([room, row, col, chessType, fd, receivedAt](){
+            room->setReceivedAt(receivedAt);
+            room->placePiece(row, col, chessType, fd);
         });
+        return;
     }
 
-    return true;
+    Json::Value root;
+    //解析失败的消息直接忽略
+    if (!parseJsonFrame(frame, root)) {
+        MessageStats::received(-1, frame.length);
+        return;
+    }
+    MessageStats::received(MessageStats::classify(root), frame.length);
+
+    if (!room && relay && relay->isWatcher(fd))
+        relay->chat(fd, root);
+    else if (!room)
+        parseJsonMsg(shard, root, fd);//还没进入房间，解析创建、加入房间等命令
+    else if (conn->getRole() == Connection::ROLE_PLAYER)
+        room->post([room, root, fd, receivedAt](){
+            room->setReceivedAt(receivedAt);
+            room->parseJsonMsg(root, fd);
+        });
+    else
+        room->post([room, root, fd](){ room->parseWatcherMsg(root, fd); });
+}
+
+void GobangServer::handleClose(LoopShard& shard, SocketFD fd) {
+    auto it = shard.connections.find(fd);
+    if (it == shard.connections.end())
+        return;
+
+    std::shared_ptr<Room> room = it->second->getRoom();
+    Connection::Role role = it->second->getRole();
+    shard.loop.removeFd(fd);
+    shard.loop.cancelTimer(it->second->getTimer());
+    Connection::remove(fd);
+    shard.connections.erase(it);
+    connectionsGauge().sub();
+
+    //房间负责关闭其中玩家和观众的socket
+    if (room && role == Connection::ROLE_PLAYER)
+        room->post([fd, r = room.get()](){ r->quitPlayer(fd); });
+    else if (room && role == Connection::ROLE_WATCHER)
+        room->post([fd, r = room.get()](){ r->quitWatcher(fd); });
+    else if (relay)
+        relay->quitWatcher(fd);     //不是中继的观众时直接关闭
+    else
+        closeSocket(fd);
+}
+
+//最后一名玩家退出后由房间发起，在房间所属的事件循环中执行。房间从目录中注销后不会再有新的连接进入，
+//剩下的观众断开时的退出任务执行完，最后一份引用释放，房间随之释放
+void GobangServer::reclaimRoom(int id, const std::vector<SocketFD>& watchers) {
+    std::shared_ptr<Room> room = rooms.remove(id);
+    if (!room)
+        return;
+
+    LOG_INFO("Deleting room: %d, rooms in use: %zu", id, rooms.size());
+    for (SocketFD fd : watchers)
+        closeInRoom(room, fd);
 }
 
-bool GobangServer::parseJsonMsg(const Json::Value& root, SocketFD fd) {
+//观众可能是别的事件循环接收的，交给它的邮箱，在那个线程里确认连接还在这个房间再关闭
+void GobangServer::closeInRoom(const std::shared_ptr<Room>& room, SocketFD fd) {
+    std::shared_ptr<Connection> conn = Connection::lookup(fd);
+    if (!conn)
+        return;
+    LoopShard* shard = shards[conn->getLoopIndex()].get();
+    shard->loop.queueInLoop([this, shard, room, fd](){
+        auto it = shard->connections.find(fd);
+        if (it != shard->connections.end() && it->second->getRoom() == room)
+            handleClose(*shard, fd);
+    });
+}
+
+//中继在订阅结束时调用，这时观众已经不在中继的名单里，handleClose直接关闭
+void GobangServer::closeRelayWatcher(SocketFD fd) {
+    std::shared_ptr<Connection> conn = Connection::lookup(fd);
+    if (!conn)
+        return;
+    LoopShard* shard = shards[conn->getLoopIndex()].get();
+    shard->loop.queueInLoop([this, shard, conn, fd](){
+        auto it = shard->connections.find(fd);
+        if (it != shard->connections.end() && it->second == conn)
+            handleClose(*shard, fd);
+    });
+}
+
+bool GobangServer::parseJsonMsg(LoopShard& shard, const Json::Value& root, SocketFD fd) {
     if (root["type"].isNull()) {
         return false;
     }
 
     std::string type = root["type"].asString();
 
+    //客户端在第一条消息中要求使用二进制分帧，之后发给它的消息都用二进制帧
+    if (root["framing"].asString() == "binary")
+        shard.connections[fd]->setFraming(FRAMING_BINARY);
+    //客户端收到pong才开始发心跳，旧的服务器不回，客户端就不会发来它不认识的ping
+    if (root["heartbeat"].asBool() && heartbeatIntervalMs > 0)
+        shard.connections[fd]->send(FRAME_PONG, std::make_shared<const std::string>());
+
     //创建房间、加入房间、观战
     if (type == "command") {
-        return processMsgTypeCmd(root, fd);
+        return processMsgTypeCmd(shard, root, fd);
     }
 
     return true;
 }
 
-bool GobangServer::processMsgTypeCmd(const Json::Value& root, SocketFD fd) {
+bool GobangServer::processMsgTypeCmd(LoopShard& shard, const Json::Value& root, SocketFD fd) {
     if (root["cmd"].isNull())
         return false;
 
     std::string cmd = root["cmd"].asString();
 
+    //中继只能观战
+    if (relay && cmd == "create_room")
+        return API::responseCreateRoom(fd, STATUS_ERROR, "This server only relays games to watchers", -1);
+    if (relay && cmd == "join_room")
+        return API::responseJoinRoom(fd, STATUS_ERROR, "This server only relays games to watchers", "", "");
+
     if (cmd == "create_room")//创建房间
-        return processCreateRoom(root, fd);
+        return processCreateRoom(shard, root, fd);
     if (cmd == "join_room")//加入房间
-        return processJoinRoom(root, fd);
+        return processJoinRoom(shard, root, fd);
     if (cmd == "watch_room")//观战
-        return processWatchRoom(root, fd);
+        return processWatchRoom(shard, root, fd);
 
     return false;
 }
 
 
 //创建一个房间，然后把创建房间的用户加入房间
-bool GobangServer::processCreateRoom(const Json::Value& root, SocketFD fd) {
+bool GobangServer::processCreateRoom(LoopShard& shard, const Json::Value& root, SocketFD fd) {
     //检查是否填写了房间名和玩家名，没有则直接返回
     if (root["room_name"].isNull() || root["player_name"].isNull())
         return false;
-    //创建房间，并初始化线程池
-    Room* room = createRoom();
-    //添加到房间数组里面
-    rooms.push_back(room);
+    //创建房间并分配房间号
+    std::shared_ptr<Room> room = createRoom();
+    if (!room)
+        return API::responseCreateRoom(fd, STATUS_ERROR, "No free room. Please try again later", -1);
     room->setName(root["room_name"].asString());
-    //添加玩家
-    room->addPlayer(root["player_name"].asString(), fd);
-    //发送响应，创建房间成功
-    return API::responseCreateRoom(fd, 0, "OK", room->getId());
+    shard.connections[fd]->bind(room, Connection::ROLE_PLAYER);
+    //添加玩家，并发送响应，创建房间成功
+    std::string playerName = root["player_name"].asString();
+    room->post([room, playerName, fd](){
+        room->addPlayer(playerName, fd);
+        API::responseCreateRoom(fd, 0, "OK", room->getId());
+    });
+    return true;
 }
 //处理玩家加入房间的请求
-bool GobangServer::processJoinRoom(const Json::Value& root, SocketFD fd) {
+bool GobangServer::processJoinRoom(LoopShard& shard, const Json::Value& root, SocketFD fd) {
     if (root["room_id"].isNull() || root["player_name"].isNull())
         return false;
 
     int roomId = root["room_id"].asInt();
     std::string playerName = root["player_name"].asString();
-    Room* room = getRoomById(roomId);
-
-    int statusCode = STATUS_ERROR;
-    std::string desc, roomName, rivalname;
-
-    do {
-        // 房间不存在
-        if (!room) {
-            desc = "The room is not exist";
-            break;
+    std::shared_ptr<Room> room = rooms.find(roomId);
+
+    // 房间不存在
+    if (!room)
+        return API::responseJoinRoom(fd, STATUS_ERROR, "The room is not exist", "", "");
+
+    //先绑定，保证之后收到的消息在加入房间之后执行；加入失败再解绑
+    shard.connections[fd]->bind(room, Connection::ROLE_PLAYER);
+    room->post([this, &shard, room, playerName, fd](){
+        //崩溃后恢复的房间，按名字回到原来的座位，接着发棋盘
+        if (!room->shouldDelete() && room->rejoin(playerName, fd)) {
+            API::responseJoinRoom(fd, STATUS_OK, "", room->getName(), room->getRivalName(fd));
+            room->sendGameState(fd);
+            return;
         }
 
-        //获取对战玩家的人数，看看是否可以加入
-        int numPlayers = room->getNumPlayers();
+        int statusCode = STATUS_ERROR;
+        std::string desc, roomName, rivalname;
 
-        //人数够了
-        if (numPlayers == 2) {
-            desc = "The room is full";
-            break;
-        }
-        else if (numPlayers == 1) {
-            Player& player1 = room->getPlayer1();
-            //检查一下名字是否相同
-            if (player1.name == playerName) {
-                desc = "The name of two players cant't be same";
+        do {
+            //最后一名玩家刚刚退出，房间正在回收
+            if (room->shouldDelete()) {
+                desc = "The room is not exist";
+                break;
+            }
+            //获取对战玩家的人数，看看是否可以加入，留给还没有重新加入的玩家的座位也算
+            int numPlayers = room->getNumPlayers() + room->getNumReserved();
+
+            //人数够了
+            if (numPlayers == 2) {
+                desc = "The room is full";
+                break;
+            }
+            else if (numPlayers == 1) {
+                std::string player1Name = room->getRivalName(fd);
+                //检查一下名字是否相同
+                if (player1Name == playerName) {
+                    desc = "The name of two players cant't be same";
+                    break;
+                }
+                //不同，记录新加入玩家的名字
+                roomName = room->getName();
+                rivalname = player1Name;
+            }
+            else {
+                desc = "Server Internal Error. Please try to join another room";
                 break;
             }
-            //不同，记录新加入玩家的名字
-            roomName = room->getName();
-            rivalname = player1.name;
+            //加入房间
+            room->addPlayer(playerName, fd);
+            statusCode = STATUS_OK;
+        } while (false);
+
+        // 成功加入房间后，向发起加入房间请求的玩家通知他加入成功了
+        API::responseJoinRoom(fd, statusCode, desc, roomName, rivalname);
+
+        if (statusCode == STATUS_OK) {
+            //通知对手，对手还没有重新加入时不用通知
+            if (room->getNumPlayers() == 2)
+                API::notifyRivalInfo(room->getPlayer1().socketfd, playerName);
         }
         else {
-            desc = "Server Internal Error. Please try to join another room";
-            break;
+            unbindLater(shard, room, fd);
         }
-        //加入房间
-        room->addPlayer(playerName, fd);
-        statusCode = STATUS_OK;
-    } while (false);
-
-    // 成功加入房间后，向发起加入房间请求的玩家通知他加入成功了
-    API::responseJoinRoom(fd, statusCode, desc, roomName, rivalname);
-
-    if (room && statusCode == STATUS_OK)
-        //通知对手
-        return API::notifyRivalInfo(room->getPlayer1().socketfd, playerName);
-    else
-        return false;
+    });
+    return true;
 }
 //处理观战
-bool GobangServer::processWatchRoom(const Json::Value& root, SocketFD fd) {
+bool GobangServer::processWatchRoom(LoopShard& shard, const Json::Value& root, SocketFD fd) {
     if (root["room_id"].isNull() || root["player_name"].isNull())
         return false;
 
     int roomId = root["room_id"].asInt();
     std::string playerName = root["player_name"].asString();
-    Room* room = getRoomById(roomId);
+    bool moveList = root["move_list"].asBool();
+    //中继：回复和棋局在订阅准备好之后由中继发送
+    if (relay) {
+        if (relay->isWatcher(fd))
+            return false;
+        relay->watch(roomId, playerName, fd, moveList);
+        return true;
+    }
+
+    std::shared_ptr<Room> room = rooms.find(roomId);
     if (room) {
-        //通知发起加入请求的玩家，他加入成功了
-        API::responseWatchRoom(fd, STATUS_OK, "", room->getName());
-        room->addWatcher(playerName, fd); //向该房间添加观众
+        shard.connections[fd]->bind(room, Connection::ROLE_WATCHER);
+        room->post([this, &shard, room, playerName, moveList, fd](){
+            //房间正在回收
+            if (room->shouldDelete()) {
+                API::responseWatchRoom(fd, STATUS_ERROR, "The room is not exist", "");
+                unbindLater(shard, room, fd);
+                return;
+            }
+            //观众满了，更多的观众可以连到中继上观战
+            if (room->isFull()) {
+                API::responseWatchRoom(fd, STATUS_ERROR, "Too many watchers in this room. Please watch through a relay", "");
+                unbindLater(shard, room, fd);
+                return;
+            }
+            //通知发起加入请求的玩家，他加入成功了
+            API::responseWatchRoom(fd, STATUS_OK, "", room->getName());
+            room->addWatcher(playerName, fd, moveList); //向该房间添加观众
+        });
     }
     else{
         //房间不存在，通知一下
@@ -246,32 +930,38 @@ bool GobangServer::processDeleteRoom(const Json::Value& root, SocketFD fd) {
 /*****************************************************************************/
 /*****************************************************************************/
 
-Room* GobangServer::createRoom() {
-    if (rooms.size() > 100)
-        return nullptr;
-
-    Room* room = new Room();
-
-    while (true) {
-        //获取一个随机数作为房间id
-        int randNum = rand() % 9000 + 1000;
-        auto iter = std::find(roomsId.begin(), roomsId.end(), randNum);
-        if (iter == roomsId.end()) {
-            roomsId.push_back(randNum);
-            room->setId(randNum);
-            break;
-        }
-    }
-
+std::shared_ptr<Room> GobangServer::createRoom() {
+    std::shared_ptr<Room> room = std::make_shared<Room>(pool);
+    //房间号用完了
+    int id = rooms.add(room);
+    if (id < 0)
+        return std::shared_ptr<Room>();
+    setupRoom(room);
     return room;
 }
-//通过房间ID拿到房间
-Room* GobangServer::getRoomById(int id) {
-    for (int i = 0, size = rooms.size(); i < size; ++i) {
-        if (rooms[i]->getId() == id)
-            return rooms[i];
-    }
-    return nullptr;
-}
 
+//房间按房间号分给事件循环，每步计时和回收都在那个事件循环中
+void GobangServer::setupRoom(const std::shared_ptr<Room>& room) {
+    int id = room->getId();
+    LoopShard& home = homeOf(id);
+    if (moveTimeoutMs > 0)
+        room->setMoveTimeout(&home.loop, moveTimeoutMs);
+    if (store.isOpen())
+        room->setStore(&store);
+    if (gameLog.isRunning())
+        room->setGameLog(&gameLog);
+    room->setMaxWatchers(maxWatchers);
+    //回调保存在房间里，只能记房间号，不能持有房间
+    room->setOnEmpty([this, &home, id](const std::vector<SocketFD>& watchers){
+        home.loop.queueInLoop([this, id, watchers](){ reclaimRoom(id, watchers); });
+    });
+}
 
+//加入房间失败，回到连接所属的事件循环线程解绑连接
+void GobangServer::unbindLater(LoopShard& shard, const std::shared_ptr<Room>& room, SocketFD fd) {
+    shard.loop.queueInLoop([&shard, room, fd](){
+        auto it = shard.connections.find(fd);
+        if (it != shard.connections.end() && it->second->getRoom() == room)
+            it->second->bind(std::shared_ptr<Room>(), Connection::ROLE_NONE);
+    });
+}
@@ -1,11 +1,23 @@
 #pragma once
 
 #include "jsoncpp/json/json.h"
+#include "admin_server.h"
+#include "connection.h"
+#include "event_loop.h"
+#include "relay.h"
 #include "room.h"
+#include "room_directory.h"
+#include "room_store.h"
 #include "socket_func.h"
 #include "thread_pool.h"
 
 
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 class GobangServer {
@@ -13,30 +25,119 @@ public:
     GobangServer();
 
 public:
-    bool start(int port);
-    void stop();
+    bool start(int port);                                   //一直运行到stop，排空之后返回
+    void stop();                                            //请求关闭，可在任意线程和信号处理函数中调用，再调用一次则不再等待排空
+
+    void setRoomIdRange(int minId, int maxId) { rooms.setIdRange(minId, maxId); }  //在start之前调用
+    void setAdminPort(int port) { adminPort = port; }      //0表示不开管理端口，在start之前调用
+    //超时时间，毫秒，0表示不限制，在start之前调用
+    void setHandshakeTimeout(int ms) { handshakeTimeoutMs = ms; }   //连接后多久内必须发来第一条消息
+    void setIdleTimeout(int ms) { idleTimeoutMs = ms; }             //不在房间的连接和玩家多久没有消息就断开
+    void setMoveTimeout(int ms) { moveTimeoutMs = ms; }             //每步棋的时限，超时判负
+    //客户端发ping的周期和允许丢失的次数，超过interval * misses没有收到任何数据就断开
+    void setHeartbeat(int intervalMs, int misses) { heartbeatIntervalMs = intervalMs; heartbeatMissCount = misses; }
+    void setDrainTimeout(int ms) { drainTimeoutMs = ms; }   //关闭时最多等多久把发送队列写完
+    void setKeepAliveIdle(int seconds) { keepAliveIdleSec = seconds; }  //TCP keepalive空闲多久开始探测，0表示不开
+    void setNumLoops(int n) { numLoops = n > 0 ? n : 1; }   //事件循环线程数，默认和CPU核数一致，在start之前调用
+    void setBacklog(int n) { backlog = n; }                 //每个监听socket的backlog，在start之前调用
+    //热升级用的Unix域socket：启动时如果旧进程在上面等待，就接管它的监听socket、连接和房间，之后自己在上面等待下一次升级
+    void setUpgradeSocket(const std::string& path) { upgradePath = path; }
+    //崩溃恢复用的状态文件：启动时按文件恢复房间，玩家在rejoinTimeout毫秒内按房间号和名字重新加入
+    void setStateFile(const std::string& path) { stateFile = path; }
+    void setRejoinTimeout(int ms) { rejoinTimeoutMs = ms; }
+    //结束的对局写到dir下的日志，每段写到segmentBytes字节换一个文件
+    void setGameLog(const std::string& dir, size_t segmentBytes) { gameLogDir = dir; gameLogSegmentBytes = segmentBytes; }
+    void setMaxWatchers(int n) { maxWatchers = n; }         //每个房间的观众上限，0表示不限制
+    //中继模式：不开房间，观众要看的房间向host:port订阅，转发给这里的观众；上游可以是另一个中继
+    void setRelay(const std::string& host, int port) { relayHost = host; relayPort = port; }
 
 private:
-    Room* createRoom();
+    //一个事件循环线程：用SO_REUSEPORT各自监听同一个端口，由内核分配新连接，接收到的连接只在这个线程中访问
+    struct LoopShard {
+        explicit LoopShard(int index) : index(index) {}
 
-    bool parseJsonMsg(const Json::Value& root, SocketFD fd);
+        int index;
+        EventLoop loop;
+        SocketFD listenfd = -1;
+        std::unordered_map<SocketFD, std::shared_ptr<Connection>> connections;
+        std::thread thread;
+    };
 
-    bool processMsgTypeCmd(const Json::Value& root, SocketFD fd);
+    void handleAccept(LoopShard& shard);                    //接收所有已就绪的连接
+    void addConnection(LoopShard& shard, const std::shared_ptr<Connection>& conn);     //由shard的事件循环处理这个连接
+    void handleRead(LoopShard& shard, SocketFD fd);         //读取并分发一个连接上的消息
+    void handleWrite(LoopShard& shard, SocketFD fd);        //socket可写，继续写发送队列
+    void handleClose(LoopShard& shard, SocketFD fd);        //连接断开
+    void handleConnectionTimer(LoopShard& shard, SocketFD fd);      //握手或空闲超时检查
+    void dispatchFrame(LoopShard& shard, Connection* conn, const FrameView& frame);   //按消息类型分发一帧
+    void reclaimRoom(int id, const std::vector<SocketFD>& watchers);   //回收没有玩家的房间，在房间所属的事件循环中执行
+    void closeInRoom(const std::shared_ptr<Room>& room, SocketFD fd);  //到连接所属的事件循环中关闭仍在房间里的连接
+    void closeRelayWatcher(SocketFD fd);                    //到连接所属的事件循环中关闭中继的观众
 
-    bool processCreateRoom(const Json::Value& root, SocketFD fd);
-    bool processJoinRoom(const Json::Value& root, SocketFD fd);
-    bool processWatchRoom(const Json::Value& root, SocketFD fd);
-    bool processDeleteRoom(const Json::Value& root, SocketFD fd);
+    SocketFD openListener(int port, bool reusePort);        //创建非阻塞的监听socket，失败返回-1
+    void runLoops();                                        //第一个事件循环在调用线程中运行，其余各占一个线程，全部退出后返回
+    void drain();                                           //事件循环退出后关闭服务器
+    void closeConnections(bool halfClose);                  //事件循环都退出后关闭所有连接
+    void handleUpgradeRequest();                            //新进程连上了升级socket
+    void handover();                                        //旧进程：事件循环退出后把所有状态交给新进程
+    void restoreState(const Json::Value& state, const std::unordered_map<int, SocketFD>& fds);  //新进程：按快照恢复房间和连接
+    void checkDrained(LoopShard& shard);                    //这个事件循环排空完成或超时就退出
+    void recoverRooms();                                    //按状态文件恢复上次崩溃时的房间
+    void expireReservedLater(const std::shared_ptr<Room>& room);   //等不到重新加入的玩家就让出座位
+
+    LoopShard& homeOf(int roomId) { return *shards[unsigned(roomId) % shards.size()]; }  //房间的计时和回收在哪个事件循环
+    std::shared_ptr<Room> createRoom();
+    void setupRoom(const std::shared_ptr<Room>& room);     //已经登记了房间号的房间，设置计时和回收
+    void unbindLater(LoopShard& shard, const std::shared_ptr<Room>& room, SocketFD fd);
 
-    Room* getRoomById(int id);
+    bool parseJsonMsg(LoopShard& shard, const Json::Value& root, SocketFD fd);
+
+    bool processMsgTypeCmd(LoopShard& shard, const Json::Value& root, SocketFD fd);
+
+    bool processCreateRoom(LoopShard& shard, const Json::Value& root, SocketFD fd);
+    bool processJoinRoom(LoopShard& shard, const Json::Value& root, SocketFD fd);
+    bool processWatchRoom(LoopShard& shard, const Json::Value& root, SocketFD fd);
+    bool processDeleteRoom(const Json::Value& root, SocketFD fd);
 
 private:
     ThreadPool pool;
+    std::vector< std::unique_ptr<LoopShard> > shards;       //在start中创建，之后不再变化
+    int numLoops;
+    int backlog = 1024;
+
+    RoomDirectory rooms;                                    //房间号 -> 房间
+
+    AdminServer admin;                                      //本机的指标端口
+    int adminPort = 0;
+
+    std::string upgradePath;
+    SocketFD upgradefd = -1;                                //等待新进程的Unix域socket，在第一个事件循环中
+    SocketFD handoverChannel = -1;                          //已经连上来的新进程
+
+    std::string stateFile;
+    RoomStore store;                                        //房间状态的内存映射文件，没有指定文件时不打开
+    int rejoinTimeoutMs = 5 * 60 * 1000;
+
+    std::string gameLogDir;
+    size_t gameLogSegmentBytes = DEFAULT_SEGMENT_BYTES;
+    GameLog gameLog;                                        //没有指定目录时不启动
+
+    int maxWatchers = MAX_NUM_WATCHERS;
 
-    std::vector<Room*> rooms;
-    std::vector<int> roomsId;
+    std::string relayHost;
+    int relayPort = 0;
+    std::unique_ptr<Relay> relay;                           //中继模式时在start中创建
 
-    SocketFD socketfd = 0;
+    int handshakeTimeoutMs = 10 * 1000;
+    int idleTimeoutMs = 30 * 60 * 1000;
+    int moveTimeoutMs = 3 * 60 * 1000;
+    int heartbeatIntervalMs = 5 * 1000;     //和客户端的默认值一致
+    int heartbeatMissCount = 3;
+    int keepAliveIdleSec = 30;
+    int drainTimeoutMs = 5 * 1000;
 
-    bool isRunning = true;
+    std::atomic<bool> isRunning;
+    bool draining = false;                                  //正在关闭，不再处理收到的消息；在重新启动事件循环之前设置
+    std::atomic<int> pendingShutdowns;                      //还没有处理完关闭通知的房间数
+    std::chrono::steady_clock::time_point drainDeadline;
 };
@@ -0,0 +1,252 @@
+#include "logger.h"
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define RING_CAPACITY       (64 * 1024)     //每个线程的缓冲区大小，必须是2的幂
+#define MAX_RECORD_LENGTH   4096            //一条日志最长的字节数，超出的部分截断
+#define MAX_IDLE_SLEEP_MS   200             //没有日志时后台线程最长的休眠时间
+
+
+std::atomic<int> Logger::currentLevel(LOG_LEVEL_INFO);
+
+namespace {
+
+//单生产者单消费者的字节环：记录格式为 |长度 uint16|内容|
+struct LogRing {
+    char data[RING_CAPACITY];
+    std::atomic<size_t> head{0};        //消费者读位置
+    std::atomic<size_t> tail{0};        //生产者写位置
+    std::atomic<bool> alive{true};      //所属线程退出后由后台线程回收
+    std::atomic<size_t> dropped{0};     //缓冲区满时丢弃的条数
+    int threadNo = 0;
+
+    void copyIn(size_t pos, const char* src, size_t len) {
+        size_t offset = pos & (RING_CAPACITY - 1);
+        size_t first = std::min(len, size_t(RING_CAPACITY) - offset);
+        memcpy(data + offset, src, first);
+        memcpy(data, src + first, len - first);
+    }
+
+    void copyOut(size_t pos, char* dst, size_t len) const {
+        size_t offset = pos & (RING_CAPACITY - 1);
+        size_t first = std::min(len, size_t(RING_CAPACITY) - offset);
+        memcpy(dst, data + offset, first);
+        memcpy(dst + first, data, len - first);
+    }
+
+    bool push(const char* msg, size_t len) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_acquire);
+        if (RING_CAPACITY - (t - h) < len + sizeof(uint16_t)) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        uint16_t n = uint16_t(len);
+        copyIn(t, reinterpret_cast<const char*>(&n), sizeof(n));
+        copyIn(t + sizeof(n), msg, len);
+        tail.store(t + sizeof(n) + len, std::memory_order_release);
+        return true;
+    }
+
+    //把所有完整的记录写到out，返回是否写了内容
+    bool drainTo(FILE* out) {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t t = tail.load(std::memory_order_acquire);
+        if (h == t)
+            return false;
+        char buf[MAX_RECORD_LENGTH];
+        while (h != t) {
+            uint16_t n;
+            copyOut(h, reinterpret_cast<char*>(&n), sizeof(n));
+            copyOut(h + sizeof(n), buf, n);
+            fwrite(buf, 1, n, out);
+            h += sizeof(n) + n;
+        }
+        head.store(h, std::memory_order_release);
+        return true;
+    }
+};
+
+//所有线程的缓冲区，只有注册和后台线程遍历时加锁
+struct Registry {
+    std::mutex mutex;
+    std::vector< std::shared_ptr<LogRing> > rings;
+    int nextThreadNo = 0;
+
+    std::thread flusher;
+    std::atomic<bool> running{false};
+    std::mutex sleepMutex;
+    std::condition_variable wakeFlusher;                //stop时叫醒休眠中的后台线程
+    FILE* out = nullptr;
+};
+
+Registry& registry() {
+    static Registry* reg = new Registry();      //不析构，退出时其他线程可能还在写日志
+    return *reg;
+}
+
+thread_local LogRing* tlsRing = nullptr;
+thread_local bool tlsExited = false;
+
+//线程退出时标记缓冲区，剩下的内容由后台线程写完后释放
+struct RingHolder {
+    std::shared_ptr<LogRing> ring;
+    ~RingHolder() {
+        if (ring)
+            ring->alive.store(false, std::memory_order_release);
+        tlsRing = nullptr;
+        tlsExited = true;
+    }
+};
+
+//线程正在退出(比如在exit的清理函数里)时返回nullptr
+LogRing* localRing() {
+    if (tlsRing || tlsExited)
+        return tlsRing;
+
+    static thread_local RingHolder holder;
+    holder.ring = std::make_shared<LogRing>();
+    tlsRing = holder.ring.get();
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    tlsRing->threadNo = reg.nextThreadNo++;
+    reg.rings.push_back(holder.ring);
+    return tlsRing;
+}
+
+const char* levelName(int level) {
+    static const char* names[] = { "TRACE", "DEBUG", "INFO ", "WARN ", "ERROR" };
+    return (level >= 0 && level < LOG_LEVEL_OFF) ? names[level] : "?????";
+}
+
+//写出所有缓冲区，返回是否写了内容
+bool flushAll(Registry& reg) {
+    bool wrote = false;
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (auto it = reg.rings.begin(); it != reg.rings.end(); ) {
+        LogRing& ring = **it;
+        bool alive = ring.alive.load(std::memory_order_acquire);
+        wrote |= ring.drainTo(reg.out);
+
+        size_t dropped = ring.dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped) {
+            fprintf(reg.out, "[logger] thread %d dropped %zu records\n", ring.threadNo, dropped);
+            wrote = true;
+        }
+        //线程已经退出，并且内容都写完了
+        if (!alive)
+            it = reg.rings.erase(it);
+        else
+            ++it;
+    }
+    if (wrote)
+        fflush(reg.out);
+    return wrote;
+}
+
+void flushLoop() {
+    Registry& reg = registry();
+    int sleepMs = 1;
+    while (reg.running.load(std::memory_order_acquire)) {
+        //有日志时很快再来，空闲时逐渐延长休眠
+        if (flushAll(reg))
+            sleepMs = 1;
+        else
+            sleepMs = std::min(sleepMs * 2, MAX_IDLE_SLEEP_MS);
+        std::unique_lock<std::mutex> lock(reg.sleepMutex);
+        reg.wakeFlusher.wait_for(lock, std::chrono::milliseconds(sleepMs),
+                [&reg](){ return !reg.running.load(std::memory_order_acquire); });
+    }
+    flushAll(reg);
+}
+
+}   // namespace
+
+
+bool Logger::start(const std::string& path) {
+    Registry& reg = registry();
+    if (reg.running)
+        return true;
+
+    reg.out = stdout;
+    if (!path.empty()) {
+        reg.out = fopen(path.c_str(), "a");
+        if (!reg.out) {
+            reg.out = stdout;
+            return false;
+        }
+    }
+    reg.running = true;
+    reg.flusher = std::thread(flushLoop);
+    return true;
+}
+
+void Logger::stop() {
+    Registry& reg = registry();
+    {
+        std::lock_guard<std::mutex> lock(reg.sleepMutex);
+        if (!reg.running.exchange(false))
+            return;
+    }
+    reg.wakeFlusher.notify_one();
+    if (reg.flusher.joinable())
+        reg.flusher.join();
+    if (reg.out != stdout)
+        fclose(reg.out);
+    reg.out = nullptr;
+}
+
+int Logger::parseLevel(const std::string& name) {
+    static const char* names[] = { "trace", "debug", "info", "warn", "error", "off" };
+    for (int i = 0; i <= LOG_LEVEL_OFF; ++i) {
+        if (name == names[i])
+            return i;
+    }
+    return -1;
+}
+
+void Logger::write(int level, const char* fmt, ...) {
+    LogRing* ring = localRing();
+    char buf[MAX_RECORD_LENGTH];
+
+    //时间 级别 线程号
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    struct tm tm;
+    localtime_r(&tv.tv_sec, &tm);
+    int n = snprintf(buf, sizeof(buf), "%04d-%02d-%02d %02d:%02d:%02d.%03d %s [t%d] ",
+            tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+            int(tv.tv_usec / 1000), levelName(level), ring ? ring->threadNo : -1);
+
+    va_list args;
+    va_start(args, fmt);
+    int m = vsnprintf(buf + n, sizeof(buf) - n - 1, fmt, args);
+    va_end(args);
+    if (m < 0)
+        m = 0;
+    n = std::min(n + m, int(sizeof(buf)) - 2);
+    //消息自己带了换行(比如json)时不再追加
+    if (buf[n - 1] != '\n')
+        buf[n++] = '\n';
+
+    if (ring) {
+        ring->push(buf, n);
+        return;
+    }
+    //线程的缓冲区已经释放，直接写出
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    fwrite(buf, 1, n, reg.out ? reg.out : stdout);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <atomic>
+#include <string>
+
+
+enum LogLevel {
+    LOG_LEVEL_TRACE = 0,    //收发的消息内容
+    LOG_LEVEL_DEBUG = 1,
+    LOG_LEVEL_INFO = 2,
+    LOG_LEVEL_WARN = 3,
+    LOG_LEVEL_ERROR = 4,
+    LOG_LEVEL_OFF = 5
+};
+
+
+//异步日志：每个线程有自己的无锁环形缓冲区(单生产者单消费者)，写日志只是格式化后拷贝进去；
+//后台线程定期把所有缓冲区的内容写到文件。缓冲区满时丢弃新的日志并计数，不会阻塞业务线程
+class Logger {
+public:
+    //启动后台线程，path为空时写到标准输出。启动前写的日志先留在缓冲区里
+    static bool start(const std::string& path);
+    //写完缓冲区中剩下的日志，停止后台线程
+    static void stop();
+
+    static void setLevel(int level) { currentLevel.store(level, std::memory_order_relaxed); }
+    static int getLevel() { return currentLevel.load(std::memory_order_relaxed); }
+    static bool enabled(int level) { return level >= currentLevel.load(std::memory_order_relaxed); }
+    static int parseLevel(const std::string& name);     //"trace"、"info"等，无法识别时返回-1
+
+    static void write(int level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+private:
+    static std::atomic<int> currentLevel;
+};
+
+
+//级别没有打开时只有一次原子读，参数不会被求值
+#define LOG_AT(level, ...) \
+    do { if (Logger::enabled(level)) Logger::write(level, __VA_ARGS__); } while (0)
+
+#define LOG_TRACE(...)  LOG_AT(LOG_LEVEL_TRACE, __VA_ARGS__)
+#define LOG_DEBUG(...)  LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...)   LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...)   LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...)  LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
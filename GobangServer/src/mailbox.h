@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+
+//多生产者单消费者的无锁队列：任意线程push，只有拥有者一个线程pop。
+//生产者只做一次exchange和一次store，不会互相等待，也不会等消费者
+//队列里总有一个哑节点，tail指向它；pop时取出它后面节点的值，然后那个节点成为新的哑节点
+template <typename T>
+class Mailbox {
+public:
+    Mailbox() : head(new Node()), tail(head.load(std::memory_order_relaxed)) {}
+    ~Mailbox() {
+        T value;
+        while (pop(value)) {}
+        delete tail;
+    }
+    Mailbox(const Mailbox&) = delete;
+    Mailbox& operator=(const Mailbox&) = delete;
+
+public:
+    void push(T value) {
+        Node* node = new Node(std::move(value));
+        Node* prev = head.exchange(node, std::memory_order_acq_rel);
+        //在这里和下一行之间，消费者会暂时看不到node和之后的节点，生产者push完后再唤醒消费者即可
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    //只能在消费者线程中调用，队列为空(或者生产者还没有链接好)时返回false
+    bool pop(T& value) {
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (!next)
+            return false;
+        value = std::move(next->value);
+        delete tail;
+        tail = next;
+        return true;
+    }
+
+private:
+    struct Node {
+        Node() : next(nullptr) {}
+        explicit Node(T v) : next(nullptr), value(std::move(v)) {}
+        std::atomic<Node*> next;
+        T value;
+    };
+
+    std::atomic<Node*> head;            //最后push的节点，生产者竞争的地方
+    char padding[64 - sizeof(std::atomic<Node*>)];     //head和tail分在不同的缓存行
+    Node* tail;                         //哑节点，只有消费者访问
+};
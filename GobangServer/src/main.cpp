@@ -1,6 +1,8 @@
 #include "gobangserver.h"
+#include "logger.h"
 
 #include <iostream>
+#include <string>
 #include <signal.h>
 #include <stdlib.h>
 #include <time.h>
@@ -8,19 +10,97 @@
 GobangServer server;
 
 void handleCtrlC(int num);
+void handleLogLevel(int num);
 void exitFunc();
 //程序入口
 int main(int argc, char** argv) {
     //退出时执行exitfunc
     atexit(exitFunc);
-    //处理ctrl + c 信号
+    //处理ctrl + c 和 kill 信号
     signal(SIGINT, handleCtrlC);
+    signal(SIGTERM, handleCtrlC);
+    //运行时调整日志级别：SIGUSR1更详细，SIGUSR2更简略
+    signal(SIGUSR1, handleLogLevel);
+    signal(SIGUSR2, handleLogLevel);
 
     srand(time(NULL));
 
+    int port = 6666;
+    std::string logFile;
+    int heartbeatInterval = 5;
+    int heartbeatMisses = 3;
+    std::string gameLogDir;
+    size_t gameLogSegmentBytes = DEFAULT_SEGMENT_BYTES;
+    //命令行参数
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--wide-room-ids")                   //使用6位房间号
+            server.setRoomIdRange(WIDE_MIN_ROOM_ID, WIDE_MAX_ROOM_ID);
+        else if (i + 1 >= argc)
+            std::cerr << "Unknown option: " << arg << std::endl;
+        else if (arg == "--port")
+            port = atoi(argv[++i]);
+        else if (arg == "--high-water-mark")            //发送队列高水位，字节
+            Connection::setHighWaterMark(strtoul(argv[++i], NULL, 10));
+        else if (arg == "--slow-watcher-timeout")       //观众超过高水位多久后断开，秒
+            Connection::setSlowWatcherTimeout(atoi(argv[++i]) * 1000);
+        else if (arg == "--handshake-timeout")          //连接后多久内必须发来第一条消息，秒，0表示不限制
+            server.setHandshakeTimeout(atoi(argv[++i]) * 1000);
+        else if (arg == "--idle-timeout")               //不在房间的连接和玩家多久没有消息就断开，秒
+            server.setIdleTimeout(atoi(argv[++i]) * 1000);
+        else if (arg == "--move-timeout")               //每步棋的时限，秒
+            server.setMoveTimeout(atoi(argv[++i]) * 1000);
+        else if (arg == "--loops")                      //事件循环线程数，每个线程各自监听端口
+            server.setNumLoops(atoi(argv[++i]));
+        else if (arg == "--backlog")                    //每个监听socket的backlog
+            server.setBacklog(atoi(argv[++i]));
+        else if (arg == "--upgrade-socket")             //热升级用的Unix域socket路径，新进程用同样的参数启动即可接管
+            server.setUpgradeSocket(argv[++i]);
+        else if (arg == "--state-file")                 //崩溃恢复用的房间状态文件，重启后玩家可以按房间号重新加入
+            server.setStateFile(argv[++i]);
+        else if (arg == "--rejoin-timeout")             //恢复的房间等玩家重新加入多少秒，0表示一直等
+            server.setRejoinTimeout(atoi(argv[++i]) * 1000);
+        else if (arg == "--game-log")                   //结束的对局写到这个目录下，只追加
+            gameLogDir = argv[++i];
+        else if (arg == "--game-log-segment-mb")        //对局日志每段的大小，MB
+            gameLogSegmentBytes = size_t(atoi(argv[++i])) << 20;
+        else if (arg == "--max-watchers")               //每个房间的观众上限，0表示不限制
+            server.setMaxWatchers(atoi(argv[++i]));
+        else if (arg == "--relay") {                    //中继模式，host:port为源服务器或者另一个中继
+            std::string upstream = argv[++i];
+            size_t colon = upstream.rfind(':');
+            if (colon == std::string::npos || colon == 0) {
+                std::cerr << "--relay expects host:port" << std::endl;
+                return 1;
+            }
+            server.setRelay(upstream.substr(0, colon), atoi(upstream.c_str() + colon + 1));
+        }
+        else if (arg == "--drain-timeout")              //关闭时最多等多少毫秒把消息发完
+            server.setDrainTimeout(atoi(argv[++i]));
+        else if (arg == "--heartbeat-interval")         //客户端发ping的周期，秒，0表示不按心跳断开
+            heartbeatInterval = atoi(argv[++i]);
+        else if (arg == "--heartbeat-misses")           //连续多少个周期没有收到数据就断开
+            heartbeatMisses = atoi(argv[++i]);
+        else if (arg == "--keepalive-idle")             //不发心跳的客户端，TCP keepalive空闲多久开始探测，秒，0表示不开
+            server.setKeepAliveIdle(atoi(argv[++i]));
+        else if (arg == "--admin-port")                 //本机的指标端口，GET /metrics
+            server.setAdminPort(atoi(argv[++i]));
+        else if (arg == "--log-file")                   //日志文件，默认写到标准输出
+            logFile = argv[++i];
+        else if (arg == "--log-level" && Logger::parseLevel(argv[i + 1]) >= 0)  //trace debug info warn error off
+            Logger::setLevel(Logger::parseLevel(argv[++i]));
+        else
+            std::cerr << "Unknown option: " << arg << std::endl;
+    }
+
+    server.setHeartbeat(heartbeatInterval * 1000, heartbeatMisses);
+    server.setGameLog(gameLogDir, gameLogSegmentBytes);
+
+    if (!Logger::start(logFile))
+        std::cerr << "Cannot open log file " << logFile << ", logging to stdout" << std::endl;
 
     //启动服务器
-    if (!server.start(6666)) {
+    if (!server.start(port)) {
         std::cerr << "Start failed!" << std::endl;
         return 1;
     }
@@ -28,11 +108,18 @@ int main(int argc, char** argv) {
     return 0;
 }
 //565
+//第一次请求关闭，start排空后返回；排空期间再收到信号就不再等待
 void handleCtrlC(int num) {
-    exit(0);
+    server.stop();
+}
+
+void handleLogLevel(int num) {
+    int level = Logger::getLevel() + (num == SIGUSR1 ? -1 : 1);
+    if (level >= LOG_LEVEL_TRACE && level <= LOG_LEVEL_OFF)
+        Logger::setLevel(level);
 }
 
 void exitFunc() {
-    server.stop();
+    Logger::stop();
 }
 
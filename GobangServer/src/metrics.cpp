@@ -0,0 +1,307 @@
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#define HISTOGRAM_POWERS 31     //输出到2^30微秒，约18分钟
+
+
+void* CacheAligned::operator new(size_t size) {
+    void* p = NULL;
+    if (posix_memalign(&p, 64, size) != 0)
+        throw std::bad_alloc();
+    return p;
+}
+
+void CacheAligned::operator delete(void* p) {
+    free(p);
+}
+
+
+uint64_t Counter::value() const {
+    uint64_t total = 0;
+    for (const Slot& slot : slots)
+        total += slot.value.load(std::memory_order_relaxed);
+    return total;
+}
+
+int Counter::shardIndex() {
+    static std::atomic<int> nextIndex(0);
+    static thread_local int index = nextIndex.fetch_add(1, std::memory_order_relaxed) % METRIC_SHARDS;
+    return index;
+}
+
+
+//小于16的值各占一格，之后每个2的幂区间按最高的4位再分16格
+int Histogram::bucketOf(uint64_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS)
+        return int(value);
+    int exponent = 63 - __builtin_clzll(value);
+    int sub = int(value >> (exponent - 4)) & (HISTOGRAM_SUB_BUCKETS - 1);
+    return (exponent - 3) * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+void Histogram::record(uint64_t value) {
+    Shard& shard = shards[Counter::shardIndex() % HISTOGRAM_SHARDS];
+    shard.buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+void Histogram::snapshot(uint64_t* cumulative, int numPowers, uint64_t& sum, uint64_t& count) const {
+    uint64_t merged[HISTOGRAM_BUCKETS] = { 0 };
+    sum = 0;
+    for (const Shard& shard : shards) {
+        for (int i = 0; i < HISTOGRAM_BUCKETS; ++i)
+            merged[i] += shard.buckets[i].load(std::memory_order_relaxed);
+        sum += shard.sum.load(std::memory_order_relaxed);
+    }
+
+    //2^k的整数倍正好落在分桶的边界上，所以按2的幂汇总是精确的
+    count = 0;
+    int bucket = 0;
+    for (int k = 0; k < numPowers; ++k) {
+        int end = bucketOf(uint64_t(1) << k);
+        for (; bucket < end; ++bucket)
+            count += merged[bucket];
+        cumulative[k] = count;
+    }
+    for (; bucket < HISTOGRAM_BUCKETS; ++bucket)
+        count += merged[bucket];
+}
+
+
+namespace {
+
+enum MetricType { TYPE_COUNTER, TYPE_GAUGE, TYPE_HISTOGRAM, TYPE_GAUGE_FUNC, TYPE_GAUGES_FUNC };
+
+struct Series {
+    std::string labels;
+    std::unique_ptr<Counter> counter;
+    std::unique_ptr<Gauge> gauge;
+    std::unique_ptr<Histogram> histogram;
+    std::function<double()> func;
+    std::function<Metrics::LabelledValues()> labelledFunc;
+};
+
+struct Family {
+    std::string help;
+    MetricType type;
+    std::vector< std::unique_ptr<Series> > series;
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::map<std::string, Family> families;     //按名字排序输出
+};
+
+Registry& registry() {
+    static Registry* reg = new Registry();
+    return *reg;
+}
+
+Series& findOrAdd(const std::string& name, const std::string& help, MetricType type, const std::string& labels) {
+    Registry& reg = registry();
+    Family& family = reg.families[name];
+    if (family.series.empty()) {
+        family.help = help;
+        family.type = type;
+    }
+    for (auto& series : family.series) {
+        if (series->labels == labels)
+            return *series;
+    }
+    family.series.emplace_back(new Series());
+    family.series.back()->labels = labels;
+    return *family.series.back();
+}
+
+}   // namespace
+
+
+Counter& Metrics::counter(const std::string& name, const std::string& help, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    Series& series = findOrAdd(name, help, TYPE_COUNTER, labels);
+    if (!series.counter)
+        series.counter.reset(new Counter());
+    return *series.counter;
+}
+
+Gauge& Metrics::gauge(const std::string& name, const std::string& help, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    Series& series = findOrAdd(name, help, TYPE_GAUGE, labels);
+    if (!series.gauge)
+        series.gauge.reset(new Gauge());
+    return *series.gauge;
+}
+
+Histogram& Metrics::histogram(const std::string& name, const std::string& help) {
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    Series& series = findOrAdd(name, help, TYPE_HISTOGRAM, "");
+    if (!series.histogram)
+        series.histogram.reset(new Histogram());
+    return *series.histogram;
+}
+
+void Metrics::gaugeFunc(const std::string& name, const std::string& help, std::function<double()> func) {
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    findOrAdd(name, help, TYPE_GAUGE_FUNC, "").func = std::move(func);
+}
+
+void Metrics::gaugesFunc(const std::string& name, const std::string& help, std::function<LabelledValues()> func) {
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    findOrAdd(name, help, TYPE_GAUGES_FUNC, "").labelledFunc = std::move(func);
+}
+
+static std::string withLabels(const std::string& name, const std::string& labels) {
+    return labels.empty() ? name : name + "{" + labels + "}";
+}
+
+std::string Metrics::render() {
+    static const char* typeNames[] = { "counter", "gauge", "histogram", "gauge", "gauge" };
+    std::string out;
+    char line[256];
+
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    for (auto& item : registry().families) {
+        const std::string& name = item.first;
+        Family& family = item.second;
+        out += "# HELP " + name + " " + family.help + "\n";
+        out += "# TYPE " + name + " " + typeNames[family.type] + "\n";
+
+        for (auto& series : family.series) {
+            if (family.type == TYPE_COUNTER) {
+                snprintf(line, sizeof(line), " %llu\n", (unsigned long long)series->counter->value());
+                out += withLabels(name, series->labels) + line;
+            }
+            else if (family.type == TYPE_GAUGE) {
+                snprintf(line, sizeof(line), " %lld\n", (long long)series->gauge->value());
+                out += withLabels(name, series->labels) + line;
+            }
+            else if (family.type == TYPE_GAUGE_FUNC) {
+                snprintf(line, sizeof(line), " %g\n", series->func());
+                out += withLabels(name, series->labels) + line;
+            }
+            else if (family.type == TYPE_GAUGES_FUNC) {
+                for (auto& value : series->labelledFunc()) {
+                    snprintf(line, sizeof(line), " %g\n", value.second);
+                    out += withLabels(name, value.first) + line;
+                }
+            }
+            else {
+                //直方图记录的是微秒，输出时换算成秒
+                uint64_t cumulative[HISTOGRAM_POWERS], sum, count;
+                series->histogram->snapshot(cumulative, HISTOGRAM_POWERS, sum, count);
+                for (int k = 0; k < HISTOGRAM_POWERS; ++k) {
+                    snprintf(line, sizeof(line), "_bucket{le=\"%.6f\"} %llu\n",
+                            double(uint64_t(1) << k) / 1e6, (unsigned long long)cumulative[k]);
+                    out += name + line;
+                }
+                snprintf(line, sizeof(line), "_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)count);
+                out += name + line;
+                snprintf(line, sizeof(line), "_sum %g\n", double(sum) / 1e6);
+                out += name + line;
+                snprintf(line, sizeof(line), "_count %llu\n", (unsigned long long)count);
+                out += name + line;
+            }
+        }
+    }
+    return out;
+}
+
+
+namespace {
+
+struct MessageKind {
+    const char* type;
+    const char* name;       //cmd、res_cmd或sub_type
+};
+
+const MessageKind messageKinds[] = {
+    { "command", "create_room" }, { "command", "join_room" }, { "command", "watch_room" },
+    { "command", "prepare" }, { "command", "cancel_prepare" }, { "command", "exchange" },
+    { "response", "create_room" }, { "response", "join_room" }, { "response", "watch_room" },
+    { "response", "prepare" },
+    { "notify", "new_piece" }, { "notify", "game_over" }, { "notify", "rival_info" },
+    { "notify", "game_start" }, { "notify", "cancel_prepare" }, { "notify", "disconnect" },
+    { "notify", "player_info" }, { "notify", "chessboard" }, { "notify", "move_list" },
+    { "notify", "server_shutdown" },
+    { "chat", "" },
+    { "other", "" }
+};
+
+const int NUM_MESSAGE_KINDS = sizeof(messageKinds) / sizeof(messageKinds[0]);
+const int KIND_NEW_PIECE = 10;
+const int KIND_OTHER = NUM_MESSAGE_KINDS - 1;
+
+struct MessageCounters {
+    Counter* framesIn;
+    Counter* bytesIn;
+    Counter* framesOut;
+    Counter* bytesOut;
+};
+
+//第一次使用时一次性注册所有消息类型的计数器
+MessageCounters* messageCounters() {
+    static MessageCounters* counters = [](){
+        MessageCounters* c = new MessageCounters[NUM_MESSAGE_KINDS];
+        for (int i = 0; i < NUM_MESSAGE_KINDS; ++i) {
+            std::string labels = std::string("type=\"") + messageKinds[i].type +
+                    "\",name=\"" + messageKinds[i].name + "\"";
+            c[i].framesIn = &Metrics::counter("gobang_frames_received_total", "Frames received from clients", labels);
+            c[i].bytesIn = &Metrics::counter("gobang_bytes_received_total", "Frame body bytes received from clients", labels);
+            c[i].framesOut = &Metrics::counter("gobang_frames_sent_total", "Frames queued to clients", labels);
+            c[i].bytesOut = &Metrics::counter("gobang_bytes_sent_total", "Frame body bytes queued to clients", labels);
+        }
+        return c;
+    }();
+    return counters;
+}
+
+}   // namespace
+
+
+int MessageStats::classify(const Json::Value& root) {
+    const Json::Value& typeValue = root["type"];
+    if (!typeValue.isString())
+        return KIND_OTHER;
+    std::string type = typeValue.asString();
+    if (type == "chat")
+        return KIND_OTHER - 1;
+
+    const char* key = (type == "command") ? "cmd" : (type == "response") ? "res_cmd" : "sub_type";
+    const Json::Value& nameValue = root[key];
+    if (!nameValue.isString())
+        return KIND_OTHER;
+    std::string name = nameValue.asString();
+    for (int i = 0; i < KIND_OTHER; ++i) {
+        if (type == messageKinds[i].type && name == messageKinds[i].name)
+            return i;
+    }
+    return KIND_OTHER;
+}
+
+int MessageStats::move() {
+    return KIND_NEW_PIECE;
+}
+
+void MessageStats::received(int kind, size_t bytes) {
+    if (kind < 0 || kind >= NUM_MESSAGE_KINDS)
+        kind = KIND_OTHER;
+    MessageCounters& c = messageCounters()[kind];
+    c.framesIn->add();
+    c.bytesIn->add(bytes);
+}
+
+void MessageStats::sent(int kind, size_t bytes) {
+    if (kind < 0 || kind >= NUM_MESSAGE_KINDS)
+        kind = KIND_OTHER;
+    MessageCounters& c = messageCounters()[kind];
+    c.framesOut->add();
+    c.bytesOut->add(bytes);
+}
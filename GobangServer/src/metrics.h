@@ -0,0 +1,96 @@
+#pragma once
+
+#include "jsoncpp/json/json.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define METRIC_SHARDS           16      //计数器按线程分片，避免多个线程写同一个缓存行
+#define HISTOGRAM_SHARDS        4
+#define HISTOGRAM_SUB_BUCKETS   16      //每个2的幂区间再分16格，相对误差约6%
+#define HISTOGRAM_BUCKETS       976     //覆盖0到2^64
+
+
+//C++14的new不保证alignas(64)的对齐，堆上分配的指标自己按缓存行对齐
+struct CacheAligned {
+    static void* operator new(size_t size);
+    static void operator delete(void* p);
+};
+
+//只增不减的计数，每个线程写自己的分片，读取时求和
+class Counter : public CacheAligned {
+public:
+    void add(uint64_t n = 1) { slots[shardIndex()].value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const;
+
+    static int shardIndex();
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> value{0};
+    };
+    Slot slots[METRIC_SHARDS];
+};
+
+//可增可减的当前值
+class Gauge {
+public:
+    void add(int64_t n = 1) { current.fetch_add(n, std::memory_order_relaxed); }
+    void sub(int64_t n = 1) { current.fetch_sub(n, std::memory_order_relaxed); }
+    void set(int64_t n) { current.store(n, std::memory_order_relaxed); }
+    int64_t value() const { return current.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> current{0};
+};
+
+//对数线性分桶的直方图(HDR风格)，记录微秒
+class Histogram : public CacheAligned {
+public:
+    void record(uint64_t value);
+    //cumulative[k]为小于2^k微秒的样本数
+    void snapshot(uint64_t* cumulative, int numPowers, uint64_t& sum, uint64_t& count) const;
+
+    static int bucketOf(uint64_t value);
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> buckets[HISTOGRAM_BUCKETS];
+        std::atomic<uint64_t> sum{0};
+        Shard() { for (auto& b : buckets) b.store(0, std::memory_order_relaxed); }
+    };
+    Shard shards[HISTOGRAM_SHARDS];
+};
+
+
+//所有指标的注册表。注册时加锁，返回的引用一直有效，调用处用函数内的static保存，之后更新不再查表
+class Metrics {
+public:
+    static Counter& counter(const std::string& name, const std::string& help, const std::string& labels = "");
+    static Gauge& gauge(const std::string& name, const std::string& help, const std::string& labels = "");
+    static Histogram& histogram(const std::string& name, const std::string& help);
+    static void gaugeFunc(const std::string& name, const std::string& help, std::function<double()> func);  //读取时才求值
+    //读取时才求值，每次返回的序列可以不同，标签如room="1234"
+    typedef std::vector< std::pair<std::string, double> > LabelledValues;
+    static void gaugesFunc(const std::string& name, const std::string& help, std::function<LabelledValues()> func);
+
+    static std::string render();        //Prometheus文本格式
+};
+
+
+//按消息的type和cmd/res_cmd/sub_type统计收发的帧数和字节数。只统计已知的消息，其他的都算作other，
+//避免客户端随便发的字符串让标签无限增长
+class MessageStats {
+public:
+    static int classify(const Json::Value& root);
+    static int move();                  //二进制落子消息
+
+    static void received(int kind, size_t bytes);
+    static void sent(int kind, size_t bytes);
+};
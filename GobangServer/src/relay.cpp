@@ -0,0 +1,470 @@
+#include "relay.h"
+
+#include "api.h"
+#include "logger.h"
+#include "metrics.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#define RELAY_PLAYER_NAME   "relay"     //中继在上游房间里的观众名字
+
+
+//中继的观众也按观众对待：不因空闲断开，发送队列积压太久会被断开
+static void setWatcherRole(SocketFD fd, Connection::Role role) {
+    std::shared_ptr<Connection> conn = Connection::lookup(fd);
+    if (conn)
+        conn->setRole(role);
+}
+
+static Gauge& watchersGauge() {
+    static Gauge& gauge = Metrics::gauge("gobang_watchers", "Watchers in rooms");
+    return gauge;
+}
+
+//旧的上游不认识move_list，只回整个棋盘。真实的落子顺序已经丢了，按黑白交替排出一个能下出同样棋局的顺序，最后一手放在最后
+static bool movesFromChessBoard(const Json::Value& root, std::vector<uint8_t>& moves) {
+    const Json::Value& layout = root["layout"];
+    if (!layout.isArray() || layout.size() != BitBoard::SIZE * BitBoard::SIZE)
+        return false;
+    const Json::Value& lastPiece = root["last_piece"];
+    int last = -1;
+    if (lastPiece["type"].asInt() != CHESS_NULL)
+        last = lastPiece["row"].asInt() * BitBoard::SIZE + lastPiece["col"].asInt();
+
+    std::vector<uint8_t> black, white;
+    for (Json::ArrayIndex i = 0; i < layout.size(); ++i) {
+        int type = layout[i].asInt();
+        if (type == CHESS_BLACK)
+            black.push_back(uint8_t(i));
+        else if (type == CHESS_WHITE)
+            white.push_back(uint8_t(i));
+    }
+    //黑棋先手，黑棋和白棋一样多或者多一颗
+    if (black.size() != white.size() && black.size() != white.size() + 1)
+        return false;
+    std::vector<uint8_t>& lastSide = (black.size() > white.size()) ? black : white;
+    auto it = std::find(lastSide.begin(), lastSide.end(), last);
+    if (it != lastSide.end())
+        std::swap(*it, lastSide.back());
+
+    moves.clear();
+    for (size_t i = 0; i < black.size(); ++i) {
+        moves.push_back(black[i]);
+        if (i < white.size())
+            moves.push_back(white[i]);
+    }
+    return true;
+}
+
+
+Relay::Relay(const std::string& host, int port, LoopOf loopOf, CloseWatcher closeWatcher) :
+    host(host),
+    port(port),
+    loopOf(std::move(loopOf)),
+    closeWatcher(std::move(closeWatcher))
+{
+    memset(&address, 0, sizeof(address));
+    Metrics::gaugeFunc("gobang_relay_rooms", "Rooms this relay is subscribed to upstream",
+            [this](){ return double(size()); });
+}
+
+bool Relay::start() {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = NULL;
+    int ret = getaddrinfo(host.c_str(), NULL, &hints, &result);
+    if (ret != 0 || !result) {
+        LOG_ERROR("Cannot resolve relay upstream %s: %s", host.c_str(), gai_strerror(ret));
+        return false;
+    }
+    memcpy(&address, result->ai_addr, sizeof(address));
+    address.sin_port = htons(port);
+    freeaddrinfo(result);
+    LOG_INFO("Relaying rooms from %s:%d", host.c_str(), port);
+    return true;
+}
+
+//先登记，订阅在房间所在的事件循环里做；登记之前观众就断开了的话，投递过去的任务发现不在表里直接返回
+void Relay::watch(int roomId, const std::string& name, SocketFD fd, bool moveList) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        watcherRooms[fd] = roomId;
+    }
+    setWatcherRole(fd, Connection::ROLE_WATCHER);
+    loopOf(roomId)->queueInLoop([this, roomId, name, fd, moveList](){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = watcherRooms.find(fd);
+            if (it == watcherRooms.end() || it->second != roomId)
+                return;
+        }
+        SubscriptionPtr sub = subscribe(roomId);
+        if (!sub) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                watcherRooms.erase(fd);
+            }
+            setWatcherRole(fd, Connection::ROLE_NONE);
+            API::responseWatchRoom(fd, STATUS_ERROR, "Cannot reach the game server", "");
+            return;
+        }
+        Pending watcher = { name, fd, moveList };
+        if (sub->ready)
+            admit(sub, watcher);
+        else
+            sub->pending.push_back(watcher);
+    });
+}
+
+void Relay::chat(SocketFD fd, const Json::Value& root) {
+    //同Room::parseWatcherMsg，观众只能聊天
+    if (root["type"].isNull() || root["type"].asString() != "chat" ||
+            root["message"].isNull() || root["sender"].isNull())
+        return;
+    int roomId;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = watcherRooms.find(fd);
+        if (it == watcherRooms.end())
+            return;
+        roomId = it->second;
+    }
+    Packet packet = API::pack(root);
+    loopOf(roomId)->queueInLoop([this, roomId, fd, packet](){
+        SubscriptionPtr sub;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = subscriptions.find(roomId);
+            if (it != subscriptions.end())
+                sub = it->second;
+        }
+        if (!sub || !sub->ready)
+            return;
+        //上游把消息发给除了中继以外的所有人，这里的观众由中继自己转发
+        broadcast(sub, packet, fd);
+        sub->upstream->send(packet.kind, packet.body);
+    });
+}
+
+//从订阅里移除之后才关闭socket，fd被新连接复用时不会收到这个房间的消息
+void Relay::quitWatcher(SocketFD fd) {
+    int roomId;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = watcherRooms.find(fd);
+        if (it == watcherRooms.end()) {
+            closeSocket(fd);
+            return;
+        }
+        roomId = it->second;
+        watcherRooms.erase(it);
+    }
+    loopOf(roomId)->queueInLoop([this, roomId, fd](){
+        SubscriptionPtr sub;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = subscriptions.find(roomId);
+            if (it != subscriptions.end())
+                sub = it->second;
+        }
+        if (sub) {
+            for (auto it = sub->watchers.begin(); it != sub->watchers.end(); ++it) {
+                if (it->socketfd == fd) {
+                    sub->watchers.erase(it);
+                    watchersGauge().sub();
+                    break;
+                }
+            }
+            for (auto it = sub->pending.begin(); it != sub->pending.end(); ++it) {
+                if (it->fd == fd) {
+                    sub->pending.erase(it);
+                    break;
+                }
+            }
+            //没有观众了就退订
+            if (sub->watchers.empty() && sub->pending.empty())
+                finish(sub, "");
+        }
+        closeSocket(fd);
+        LOG_DEBUG("Relay room %d: watcher quit", roomId);
+    });
+}
+
+bool Relay::isWatcher(SocketFD fd) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return watcherRooms.count(fd) > 0;
+}
+
+size_t Relay::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return subscriptions.size();
+}
+
+void Relay::stop() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& item : subscriptions) {
+        Subscription* sub = item.second.get();
+        sub->closed = true;
+        sub->loop->removeFd(sub->upstream->getFd());
+        closeSocket(sub->upstream->getFd());
+    }
+    subscriptions.clear();
+    watcherRooms.clear();
+}
+
+
+/***********************
+ * Upstream
+***********************/
+//非阻塞地连接上游，连上之后(第一次可写)再发观战请求
+Relay::SubscriptionPtr Relay::subscribe(int roomId) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = subscriptions.find(roomId);
+        if (it != subscriptions.end())
+            return it->second;
+    }
+
+    SocketFD fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        LOG_ERROR("create socket error: %s(errno: %d)", strerror(errno), errno);
+        return SubscriptionPtr();
+    }
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) == -1 && errno != EINPROGRESS) {
+        LOG_WARN("Relay room %d: connect upstream error: %s(errno: %d)", roomId, strerror(errno), errno);
+        closeSocket(fd);
+        return SubscriptionPtr();
+    }
+    setKeepAlive(fd, 30);
+
+    SubscriptionPtr sub = std::make_shared<Subscription>();
+    sub->roomId = roomId;
+    sub->loop = loopOf(roomId);
+    sub->upstream = std::make_shared<Connection>(fd);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        subscriptions[roomId] = sub;
+    }
+    //回调持有订阅，finish中注销fd时释放
+    sub->loop->addFd(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, [this, sub](uint32_t events){
+        handleUpstream(sub, events);
+    });
+    LOG_INFO("Relay room %d: subscribing upstream", roomId);
+    return sub;
+}
+
+void Relay::handleUpstream(const SubscriptionPtr& sub, uint32_t events) {
+    if (sub->closed)
+        return;
+    Connection* upstream = sub->upstream.get();
+
+    if (!sub->connected) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(upstream->getFd(), SOL_SOCKET, SO_ERROR, &error, &length) == -1)
+            error = errno;
+        if (error != 0) {
+            LOG_WARN("Relay room %d: connect upstream error: %s(errno: %d)", sub->roomId, strerror(error), error);
+            finish(sub, "Cannot reach the game server");
+            return;
+        }
+        if (!(events & EPOLLOUT))
+            return;
+        sub->connected = true;
+
+        //第一条消息用文本帧，同时要求之后用二进制帧，落子只有2字节；中途加入按落子顺序同步
+        Json::Value root;
+        root["type"] = "command";
+        root["cmd"] = "watch_room";
+        root["room_id"] = sub->roomId;
+        root["player_name"] = RELAY_PLAYER_NAME;
+        root["framing"] = "binary";
+        root["move_list"] = true;
+        Packet request = API::pack(root);
+        upstream->send(request.kind, request.body);
+        upstream->setFraming(FRAMING_BINARY);
+    }
+
+    if (events & EPOLLOUT)
+        upstream->flush();
+    if (!(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+        return;
+
+    bool closed = false;
+    bool more = true;
+    while (more && !closed && !sub->closed) {
+        int readRet = upstream->readAvailable();
+        closed = (readRet == FrameDecoder::READ_CLOSED);
+        more = (readRet == FrameDecoder::READ_FULL);
+
+        FrameView frame;
+        int ret;
+        while (!sub->closed && (ret = upstream->nextFrame(frame)) == FrameDecoder::FRAME_OK)
+            handleFrame(sub, frame);
+        if (ret == FrameDecoder::FRAME_BAD)
+            closed = true;
+    }
+    if (closed)
+        finish(sub, "The room is not exist");
+}
+
+//上游是服务器，内容可信，只检查长度和取值范围
+void Relay::handleFrame(const SubscriptionPtr& sub, const FrameView& frame) {
+    if (frame.kind == FRAME_MOVE) {
+        int row, col, chessType;
+        if (!decodeMove(frame.data, frame.length, row, col, chessType))
+            return;
+        sub->moves.push_back(uint8_t(row * BitBoard::SIZE + col));
+        ++sub->version;
+        broadcast(sub, API::packNewPiece(row, col, chessType));
+        return;
+    }
+    if (frame.kind == FRAME_MOVE_LIST) {
+        sub->moves.assign((const uint8_t*)frame.data, (const uint8_t*)frame.data + frame.length);
+        ++sub->version;
+        sub->ready = true;
+    }
+    else if (frame.kind == FRAME_JSON) {
+        Json::Value root;
+        if (parseJsonFrame(frame, root))
+            handleJson(sub, root, frame);
+    }
+
+    //收到落子顺序之后，之前等着的观众一起加入
+    if (sub->ready && !sub->pending.empty()) {
+        std::vector<Pending> pending;
+        pending.swap(sub->pending);
+        for (const Pending& watcher : pending)
+            admit(sub, watcher);
+    }
+}
+
+void Relay::handleJson(const SubscriptionPtr& sub, const Json::Value& root, const FrameView& frame) {
+    if (API::isTypeNotify(root, "new_piece")) {
+        int row = root["row"].asInt(), col = root["col"].asInt();
+        if (row < 0 || row >= BitBoard::SIZE || col < 0 || col >= BitBoard::SIZE)
+            return;
+        sub->moves.push_back(uint8_t(row * BitBoard::SIZE + col));
+        ++sub->version;
+        broadcast(sub, API::packNewPiece(row, col, root["chess_type"].asInt()));
+        return;
+    }
+    if (API::isTypeNotify(root, "move_list")) {
+        sub->moves.clear();
+        for (const Json::Value& move : root["moves"])
+            sub->moves.push_back(uint8_t(move.asUInt()));
+        ++sub->version;
+        sub->ready = true;
+        return;
+    }
+    if (API::isTypeNotify(root, "chessboard")) {
+        if (!movesFromChessBoard(root, sub->moves)) {
+            finish(sub, "Cannot read the chessboard of the room");
+            return;
+        }
+        ++sub->version;
+        sub->ready = true;
+        return;
+    }
+    if (!root["type"].isNull() && root["type"].asString() == "response") {
+        if (root["res_cmd"].asString() != "watch_room")
+            return;
+        if (root["status"].asInt() != STATUS_OK) {
+            finish(sub, root["desc"].asString());
+            return;
+        }
+        sub->roomName = root["room_name"].asString();
+        return;
+    }
+
+    //其余的消息原样转发，不再序列化一次
+    Packet packet;
+    packet.body = std::make_shared<const std::string>(frame.data, frame.length);
+    packet.statKind = MessageStats::classify(root);
+    if (API::isTypeNotify(root, "player_info")) {
+        sub->playerInfo = packet;
+        ++sub->version;
+    }
+    else if (API::isTypeNotify(root, "game_start")) {
+        sub->moves.clear();
+        ++sub->version;
+    }
+    broadcast(sub, packet);
+}
+
+//和Room::sendJoinPayload一样按版本缓存，一大批观众同时加入时棋局只编码一次
+void Relay::admit(const SubscriptionPtr& sub, const Pending& watcher) {
+    sub->watchers.emplace_back(watcher.name, watcher.fd);
+    watchersGauge().add();
+    API::responseWatchRoom(watcher.fd, STATUS_OK, "", sub->roomName);
+    if (sub->playerInfo.body)
+        sendPacket(sub->playerInfo, watcher.fd);
+
+    if (sub->cachedVersion != sub->version) {
+        sub->cachedVersion = sub->version;
+        sub->chessBoard = Packet();
+        sub->moveList = Packet();
+    }
+    Packet& state = watcher.moveList ? sub->moveList : sub->chessBoard;
+    if (!state.body && watcher.moveList) {
+        state = API::packMoveList(sub->moves);
+    }
+    else if (!state.body) {
+        //按顺序重新下一遍，黑棋先手
+        BitBoard board;
+        ChessPieceInfo last = { 0, 0, CHESS_NULL };
+        ChessType color = CHESS_BLACK;
+        for (uint8_t move : sub->moves) {
+            last = { move / BitBoard::SIZE, move % BitBoard::SIZE, color };
+            board.set(last.row, last.col, color);
+            color = reverse(color);
+        }
+        state = API::packChessBoard(board, last);
+    }
+    sendPacket(state, watcher.fd);
+}
+
+void Relay::broadcast(const SubscriptionPtr& sub, const Packet& packet, SocketFD except) {
+    for (auto& watcher : sub->watchers) {
+        if (watcher.socketfd != except)
+            sendPacket(packet, watcher.socketfd);
+    }
+}
+
+//还在等的观众收到失败的回复，回到大厅；已经在看的观众和源服务器回收房间时一样被断开。reason为空表示没有观众了，主动退订
+void Relay::finish(const SubscriptionPtr& sub, const std::string& reason) {
+    if (sub->closed)
+        return;
+    sub->closed = true;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = subscriptions.find(sub->roomId);
+        if (it != subscriptions.end() && it->second == sub)
+            subscriptions.erase(it);
+        for (const Watcher& watcher : sub->watchers)
+            watcherRooms.erase(watcher.socketfd);
+        for (const Pending& watcher : sub->pending)
+            watcherRooms.erase(watcher.fd);
+    }
+    sub->loop->removeFd(sub->upstream->getFd());
+    closeSocket(sub->upstream->getFd());
+    LOG_INFO("Relay room %d: unsubscribed%s%s", sub->roomId, reason.empty() ? "" : ", ", reason.c_str());
+
+    for (const Pending& watcher : sub->pending) {
+        setWatcherRole(watcher.fd, Connection::ROLE_NONE);
+        API::responseWatchRoom(watcher.fd, STATUS_ERROR, reason, "");
+    }
+    watchersGauge().sub(sub->watchers.size());
+    for (const Watcher& watcher : sub->watchers)
+        closeWatcher(watcher.socketfd);
+    sub->pending.clear();
+    sub->watchers.clear();
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "bitboard.h"
+#include "connection.h"
+#include "event_loop.h"
+#include "player.h"
+#include "socket_func.h"
+#include "jsoncpp/json/json.h"
+
+#include <netinet/in.h>
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+//观战中继：自己不开房间，观众要看的房间向上游(源服务器或者另一个中继)订阅一次，上游只把中继当作一名观众。
+//上游发来的落子、聊天和双方信息转发给这里的所有观众，观众再多上游的广播成本也不变；中继可以一级级串起来。
+//每个订阅只在一个事件循环里处理：上游的socket注册在那里，观众的加入、退出也投递到那里执行
+class Relay {
+public:
+    typedef std::function<EventLoop*(int roomId)> LoopOf;
+    typedef std::function<void(SocketFD fd)> CloseWatcher;
+
+    //loopOf给出订阅所在的事件循环；订阅结束时用closeWatcher让服务器在连接所属的事件循环里关闭还在看的观众
+    Relay(const std::string& host, int port, LoopOf loopOf, CloseWatcher closeWatcher);
+    ~Relay() {}
+    Relay(const Relay&) = delete;
+    Relay& operator=(const Relay&) = delete;
+
+public:
+    bool start();                                                          //解析上游地址，在事件循环启动之前调用
+
+    //以下函数可以在任意线程调用
+    void watch(int roomId, const std::string& name, SocketFD fd, bool moveList);   //加入观战，这个房间还没有订阅时先订阅
+    void chat(SocketFD fd, const Json::Value& root);                       //观众的聊天，发给这里的其他观众和上游
+    void quitWatcher(SocketFD fd);                                         //观众断开，由这个函数关闭socket
+    bool isWatcher(SocketFD fd);
+    void stop();                                                           //事件循环都已经退出，断开所有上游
+    size_t size();                                                         //订阅的房间数
+
+private:
+    struct Pending {
+        std::string name;
+        SocketFD fd;
+        bool moveList;
+    };
+
+    //一个被订阅的房间，除了在map里登记，其余只在所在的事件循环里访问
+    struct Subscription {
+        int roomId = -1;
+        EventLoop* loop = nullptr;
+        std::shared_ptr<Connection> upstream;
+        bool connected = false;
+        bool ready = false;                 //收到了落子顺序或者棋盘，新观众可以马上拿到完整的棋局
+        bool closed = false;
+
+        std::string roomName;
+        Packet playerInfo;                  //上游最后一次发来的双方信息，原样转发
+        std::vector<uint8_t> moves;
+        uint64_t version = 1;               //每次棋局变化加一，同Room的加入缓存
+        uint64_t cachedVersion = 0;
+        Packet chessBoard;
+        Packet moveList;
+
+        std::vector<Watcher> watchers;
+        std::vector<Pending> pending;       //上游还没准备好时加入的观众
+    };
+    typedef std::shared_ptr<Subscription> SubscriptionPtr;
+
+    SubscriptionPtr subscribe(int roomId);                                 //在所在的事件循环中调用
+    void handleUpstream(const SubscriptionPtr& sub, uint32_t events);
+    void handleFrame(const SubscriptionPtr& sub, const FrameView& frame);
+    void handleJson(const SubscriptionPtr& sub, const Json::Value& root, const FrameView& frame);
+    void admit(const SubscriptionPtr& sub, const Pending& watcher);         //回复观战成功，发送双方信息和棋局
+    void broadcast(const SubscriptionPtr& sub, const Packet& packet, SocketFD except = -1);
+    void finish(const SubscriptionPtr& sub, const std::string& reason);   //上游断开或者拒绝，关闭这个房间的所有观众
+
+private:
+    std::string host;
+    int port;
+    struct sockaddr_in address;
+    LoopOf loopOf;
+    CloseWatcher closeWatcher;
+
+    std::mutex mutex;                                           //保护下面两个表
+    std::unordered_map<int, SubscriptionPtr> subscriptions;     //房间号 -> 订阅
+    std::unordered_map<SocketFD, int> watcherRooms;             //观众 -> 房间号
+};
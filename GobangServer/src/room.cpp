@@ -1,121 +1,154 @@
 #include "room.h"
 
 #include "api.h"
+#include "event_loop.h"
+#include "logger.h"
+#include "metrics.h"
 #include "jsoncpp/json/json.h"
 
+#include <string.h>
+
 #include <algorithm>
-#include <iostream>
 #include <string>
 
-#define Log(x) std::cout << (x) << std::endl
+
+static Gauge& playersGauge() {
+    static Gauge& gauge = Metrics::gauge("gobang_players", "Players in rooms");
+    return gauge;
+}
+
+static Gauge& watchersGauge() {
+    static Gauge& gauge = Metrics::gauge("gobang_watchers", "Watchers in rooms");
+    return gauge;
+}
 
 
-Room::Room() :
-    pool(MAX_NUM_WATCHERS + 2)
+Room::Room(ThreadPool& pool) :
+    strand(std::make_shared<Strand>(pool)),
+    flagShouldDelete(false)
 {
     initChessBoard();
     lastChess = { 0, 0, CHESS_NULL };
 }
 
+//任务持有房间的引用，房间在排队的任务全部执行完之前不会被释放
+void Room::post(std::function<void()> task) {
+    std::shared_ptr<Room> self = shared_from_this();
+    strand->post([self, task = std::move(task)](){ task(); });
+}
+
 void Room::initChessBoard() {
-    for (int row = 0; row < 15; ++row) {
-        for (int col = 0; col < 15; ++col) {
-            chessPieces[row][col] = 0;
-        }
-    }
+    board.clear();
+    winDetector.clear();
+    turn = CHESS_BLACK;
 }
 
 //放置棋子
 void Room::setPiece(int row, int col, ChessType type) {
     if (row < 0 || row > 14 || col < 0 || col > 14)
         return;
-    chessPieces[row][col] = type;
+    board.set(row, col, type);
+}
+
+//按棋盘上的棋子逐个重新放一遍
+void Room::rebuildWinDetector() {
+    BitBoard full = board;
+    board.clear();
+    winDetector.clear();
+    for (int row = 0; row < BitBoard::SIZE; ++row) {
+        for (int col = 0; col < BitBoard::SIZE; ++col) {
+            ChessType type = full.get(row, col);
+            if (type == CHESS_NULL)
+                continue;
+            board.set(row, col, type);
+            winDetector.place(board, row, col, type);
+        }
+    }
+}
+
+//整个槽位重写一遍，只是内存拷贝；在房间的strand中调用，同一个槽位不会同时有两个写者
+//所有状态变化都会走到这里，顺便让缓存的观众加入内容失效
+void Room::persist() {
+    ++stateVersion;
+    if (!store || id < 0)
+        return;
+    RoomRecord record;
+    memset(&record, 0, sizeof(record));
+    record.id = id;
+    record.status = gameStatus;
+    record.turn = turn;
+    record.lastRow = lastChess.row;
+    record.lastCol = lastChess.col;
+    record.lastType = lastChess.type;
+    record.moveNumber = std::min(game.moves.size(), sizeof(record.moves));
+    record.startMs = game.startMs;
+    memcpy(record.moves, game.moves.data(), record.moveNumber);
+    board.save(record.bits);
+    RoomStore::copyName(record.name, name);
+
+    //还没有重新加入的玩家也要写上，再崩溃一次座位仍然留着
+    std::vector<const Player*> seats = getSeats();
+    for (size_t i = 0; i < seats.size() && i < 2; ++i) {
+        RoomStore::copyName(record.seats[i].name, seats[i]->name);
+        record.seats[i].type = seats[i]->type;
+        record.seats[i].prepare = seats[i]->prepare;
+        ++record.numSeats;
+    }
+    store->save(record);
 }
 
 //将玩家加入到房间
 void Room::addPlayer(const std::string& name, SocketFD fd) {
-    //添加第一个玩家
+    //添加第一个玩家，另一个座位留给还没有重新加入的玩家时，颜色和他相反
     if (numPlayers == 0) {
-        player1 = Player(name, fd, CHESS_BLACK);
+        player1 = Player(name, fd, reserved.empty() ? CHESS_BLACK : reverse(reserved[0].type));
         numPlayers++;
     }
     else {//第二个玩家
         player2 = Player(name, fd, reverse(player1.type));
         numPlayers++;
     }
+    playersGauge().add();
+    persist();
     //通知所有观战的玩家，有新玩家加入
-    for (auto& watcher : watchers) {
-        API::notifyPlayerInfo(watcher.socketfd, player1.name, player1.type,
-                player2.name, player2.type);
-    }
-    //一个玩家加入到房间后，就会有一个线程为其一直阻塞，处理该玩家发送的消息
-    pool.enqueue([this, fd](){
-        while (1) {
-            Json::Value root;
-            int ret = recvJsonMsg(root, fd);
-            if (ret == -1) {
-                Log("Quit");
-                quitPlayer(fd);
-                return;
-            }
-            else if (ret > 0){
-                parseJsonMsg(root, fd);
-            }
-        }
-    });
+    if (!watchers.empty())
+        broadcastToWatchers(API::packPlayerInfo(player1.name, player1.type, player2.name, player2.type));
 }
 //添加观众
-void Room::addWatcher(const std::string& name, SocketFD fd) {
+void Room::addWatcher(const std::string& name, SocketFD fd, bool moveList) {
     watchers.emplace_back(name, fd);
-    //向该观众发送对局双方信息
-    API::notifyPlayerInfo(fd, player1.name, player1.type, player2.name, player2.type);
-    //发送棋盘信息
-    API::sendChessBoard(fd, this->chessPieces, lastChess);
-    //为该观众分配一个线程
-    pool.enqueue([this, fd](){
-        std::cout << "add watcher" << std::endl;
-        while (1) {
-            Json::Value root;
-            //接收该观众发来的消息
-            int ret = recvJsonMsg(root, fd);
-            std::cout << "recv watcher msg" << std::endl;
-            if (ret == -1) {
-                //接收消息失败 踢出该观众
-                Log("A watcher quit");
-                quitWatcher(fd);
-                return;
-            }
-            else if (ret > 0){
-                std::cout << "recv watcher msg" << std::endl;
-                //类型检测 观众只能发送chat类型的消息
-                if (root["type"].isNull() || root["type"].asString() != "chat" ||
-                        root["message"].isNull() || root["sender"].isNull()) {
-                    return; 
-                }
-                //向其他的观众发送该消息
-                for (auto& watcher : watchers) {
-                    if (watcher.socketfd != fd) {
-                        API::forward(watcher.socketfd, root);
-                    }
-                }
-                //向棋手发送
-                if (numPlayers >= 1)
-                    API::forward(player1.socketfd, root);
-                if (numPlayers == 2)
-                    API::forward(player2.socketfd, root);
-            }
-        }
-    });
+    watchersGauge().add();
+    sendJoinPayload(fd, moveList);
+}
+
+//向观众发送对局双方信息和棋局。状态版本没变时直接用上次编码好的body，版本变了才在下一个观众加入时重新编码
+void Room::sendJoinPayload(SocketFD fd, bool moveList) {
+    static Counter& rebuilds = Metrics::counter("gobang_join_payload_builds_total",
+            "Join payloads encoded for watchers, at most once per room state version");
+    if (joinPayload.version != stateVersion) {
+        joinPayload = JoinPayload();
+        joinPayload.version = stateVersion;
+        joinPayload.playerInfo = API::packPlayerInfo(player1.name, player1.type, player2.name, player2.type);
+        rebuilds.add();
+    }
+    sendPacket(joinPayload.playerInfo, fd);
+
+    //支持的客户端收到落子顺序，自己重放，比整个棋盘小得多，还能知道每一步的先后；老客户端仍然收到整个棋盘
+    Packet& state = moveList ? joinPayload.moveList : joinPayload.chessBoard;
+    if (!state.body)
+        state = moveList ? API::packMoveList(game.moves) : API::packChessBoard(board, lastChess);
+    sendPacket(state, fd);
 }
 //踢出玩家
 void Room::quitPlayer(SocketFD fd) {
-    std::cout << "quit player" << std::endl;
-    std::cout << numPlayers << std::endl;
     // won't happen
-    if (numPlayers <= 0)
+    if (numPlayers <= 0 || !getPlayer(fd))
         return;
 
     std::string quitPlayerName = getPlayer(fd)->name;
+    //对局中离开算输
+    if (gameStatus == GAME_RUNNING)
+        finishGame(reverse(getPlayer(fd)->type), GameRecord::REASON_DISCONNECT);
 
     //如果踢出的是房主，则另一位玩家应该接管
     if (fd == player1.socketfd) {
@@ -124,41 +157,319 @@ void Room::quitPlayer(SocketFD fd) {
     }
 
     numPlayers--;
+    playersGauge().sub();
+    exchangeFrom = -1;
     //没有玩家，房间应该删除
     if (numPlayers == 0) {
-        flagShouldDelete = true;
+        release();
     }
     else {
         //告知房间中的其他人
-        API::notifyDisconnect(player1.socketfd, quitPlayerName);
-        for (auto& watcher : watchers)
-            API::notifyDisconnect(watcher.socketfd, quitPlayerName);
+        Packet packet = API::packDisconnect(quitPlayerName);
+        sendPacket(packet, player1.socketfd);
+        broadcastToWatchers(packet);
         gameStatus = GAME_END;
         lastChess = { 0, 0, CHESS_NULL };
+        persist();
     }
 
-    std::cout << numPlayers << std::endl;
+    LOG_DEBUG("Room %d: player %s quit, players left: %d", id, quitPlayerName.c_str(), numPlayers);
     closeSocket(fd);
 }
 //踢出观众
 void Room::quitWatcher(SocketFD fd) {
-    std::cout << "quit watcher" << std::endl;
-    std::cout << watchers.size() << std::endl;
 
     //从观众列表中删除
     for (auto it = watchers.begin(); it != watchers.end(); ++it) {
         if (it->socketfd == fd) {
             watchers.erase(it);
-            return;
+            watchersGauge().sub();
+            break;
         }
     }
 
     closeSocket(fd);
-    std::cout << watchers.size() << std::endl;
+    LOG_DEBUG("Room %d: watcher quit, watchers left: %zu", id, watchers.size());
+}
+static int64_t unixMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void Room::beginGame() {
+    gameStatus = GAME_RUNNING;
+    exchangeFrom = -1;
+    initChessBoard();
+    lastChess = { 0, 0, CHESS_NULL };
+    game = GameRecord();
+    game.roomId = id;
+    game.startMs = unixMs();
+    nameSeats();
+}
+
+//记录只是编码后放进队列，不等写盘
+void Room::finishGame(int winner, GameRecord::Reason reason) {
+    gameStatus = GAME_END;
+    if (!gameLog)
+        return;
+    game.endMs = unixMs();
+    game.winner = winner;
+    game.reason = reason;
+    gameLog->append(game);
+}
+
+void Room::nameSeats() {
+    game.blackName.clear();
+    game.whiteName.clear();
+    for (const Player* player : getSeats())
+        (player->type == CHESS_BLACK ? game.blackName : game.whiteName) = player->name;
+}
+
+std::vector<const Player*> Room::getSeats() const {
+    std::vector<const Player*> seats;
+    if (numPlayers >= 1)
+        seats.push_back(&player1);
+    if (numPlayers == 2)
+        seats.push_back(&player2);
+    for (const Player& player : reserved)
+        seats.push_back(&player);
+    return seats;
+}
+
+//没有玩家了，清掉状态文件里的槽位，通知服务器回收
+void Room::release() {
+    flagShouldDelete = true;
+    if (store)
+        store->erase(id);
+    if (onEmpty) {
+        std::vector<SocketFD> watcherFds;
+        for (const Watcher& watcher : watchers)
+            watcherFds.push_back(watcher.socketfd);
+        onEmpty(watcherFds);
+    }
+}
+Json::Value Room::snapshot() const {
+    Json::Value root;
+    root["id"] = id;
+    root["name"] = name;
+    root["status"] = gameStatus;
+    root["turn"] = turn;
+
+    Json::Value layout(Json::arrayValue);
+    for (int row = 0; row < BitBoard::SIZE; ++row) {
+        for (int col = 0; col < BitBoard::SIZE; ++col)
+            layout.append(board.get(row, col));
+    }
+    root["layout"] = layout;
+
+    Json::Value last;
+    last["row"] = lastChess.row;
+    last["col"] = lastChess.col;
+    last["type"] = lastChess.type;
+    root["last_piece"] = last;
+    root["start_ms"] = Json::Int64(game.startMs);
+    Json::Value moveList(Json::arrayValue);
+    for (uint8_t move : game.moves)
+        moveList.append(move);
+    root["moves"] = moveList;
+
+    Json::Value players(Json::arrayValue);
+    const Player* list[] = { &player1, &player2 };
+    for (int i = 0; i < numPlayers; ++i) {
+        Json::Value player;
+        player["name"] = list[i]->name;
+        player["fd"] = list[i]->socketfd;
+        player["type"] = list[i]->type;
+        player["prepare"] = list[i]->prepare;
+        players.append(player);
+    }
+    root["players"] = players;
+
+    Json::Value watcherList(Json::arrayValue);
+    for (const Watcher& w : watchers) {
+        Json::Value watcher;
+        watcher["name"] = w.name;
+        watcher["fd"] = w.socketfd;
+        watcherList.append(watcher);
+    }
+    root["watchers"] = watcherList;
+
+    Json::Value reservedList(Json::arrayValue);
+    for (const Player& p : reserved) {
+        Json::Value player;
+        player["name"] = p.name;
+        player["type"] = p.type;
+        reservedList.append(player);
+    }
+    root["reserved"] = reservedList;
+    return root;
+}
+
+void Room::restore(const Json::Value& root, const std::unordered_map<int, SocketFD>& fds) {
+    name = root["name"].asString();
+    gameStatus = GameStatus(root["status"].asInt());
+    lastChess.row = root["last_piece"]["row"].asInt();
+    lastChess.col = root["last_piece"]["col"].asInt();
+    lastChess.type = root["last_piece"]["type"].asInt();
+
+    //连五的状态由棋盘重新算出来
+    const Json::Value& layout = root["layout"];
+    for (int row = 0; row < BitBoard::SIZE; ++row) {
+        for (int col = 0; col < BitBoard::SIZE; ++col)
+            board.set(row, col, ChessType(layout[row * BitBoard::SIZE + col].asInt()));
+    }
+    rebuildWinDetector();
+    turn = ChessType(root["turn"].asInt());
+
+    //交接时已经断开的连接不会出现在fds中，直接略过
+    numPlayers = 0;
+    for (const Json::Value& p : root["players"]) {
+        auto it = fds.find(p["fd"].asInt());
+        if (it == fds.end())
+            continue;
+        Player& player = numPlayers == 0 ? player1 : player2;
+        player = Player(p["name"].asString(), it->second, ChessType(p["type"].asInt()));
+        player.prepare = p["prepare"].asBool();
+        ++numPlayers;
+        playersGauge().add();
+    }
+    for (const Json::Value& w : root["watchers"]) {
+        auto it = fds.find(w["fd"].asInt());
+        if (it == fds.end())
+            continue;
+        watchers.emplace_back(w["name"].asString(), it->second);
+        watchersGauge().add();
+    }
+    for (const Json::Value& p : root["reserved"])
+        reserved.emplace_back(p["name"].asString(), -1, ChessType(p["type"].asInt()));
+    game.roomId = id;
+    game.startMs = root["start_ms"].asInt64();
+    for (const Json::Value& move : root["moves"])
+        game.moves.push_back(uint8_t(move.asUInt()));
+    nameSeats();
+
+    persist();
+    if (gameStatus == GAME_RUNNING && reserved.empty())
+        startMoveClock();
+}
+
+//文件里的数据不完全可信：状态和颜色取值不对就当作对局已经结束，棋子数和记录的不一致也不能继续下
+void Room::recover(const RoomRecord& record) {
+    name = std::string(record.name, strnlen(record.name, STORE_NAME_LENGTH));
+    gameStatus = record.status == GAME_RUNNING ? GAME_RUNNING : GAME_END;
+    turn = record.turn == CHESS_WHITE ? CHESS_WHITE : CHESS_BLACK;
+    lastChess = { record.lastRow, record.lastCol, record.lastType };
+    board.load(record.bits);
+    rebuildWinDetector();
+
+    //按落子顺序重新下一遍，应该和保存的棋盘完全一样
+    game.roomId = id;
+    game.startMs = record.startMs;
+    game.moves.assign(record.moves, record.moves + std::min(record.moveNumber, uint32_t(sizeof(record.moves))));
+    BitBoard replay;
+    ChessType color = CHESS_BLACK;
+    for (uint8_t move : game.moves) {
+        replay.set(move / BitBoard::SIZE, move % BitBoard::SIZE, color);
+        color = reverse(color);
+    }
+    uint64_t expected[8], actual[8];
+    board.save(expected);
+    replay.save(actual);
+    if (gameStatus == GAME_RUNNING && memcmp(expected, actual, sizeof(expected)) != 0) {
+        LOG_WARN("Room %d: board does not match the %u recorded moves, game ended", id, record.moveNumber);
+        gameStatus = GAME_END;
+    }
+
+    //准备的状态不保留，回来之后重新准备
+    for (uint32_t i = 0; i < record.numSeats && i < 2; ++i) {
+        const RoomRecord::Seat& seat = record.seats[i];
+        ChessType type = seat.type == CHESS_WHITE ? CHESS_WHITE : CHESS_BLACK;
+        reserved.emplace_back(std::string(seat.name, strnlen(seat.name, STORE_NAME_LENGTH)), -1, type);
+    }
+    if (reserved.size() == 2 && reserved[0].type == reserved[1].type)
+        reserved[1].type = reverse(reserved[0].type);
+    nameSeats();
+}
+
+//名字在状态文件里可能被截断过，按截断后的比较
+bool Room::rejoin(const std::string& playerName, SocketFD fd) {
+    std::string fitted = RoomStore::fitName(playerName);
+    for (auto it = reserved.begin(); it != reserved.end(); ++it) {
+        if (it->name != fitted)
+            continue;
+        Player& player = numPlayers == 0 ? player1 : player2;
+        player = Player(playerName, fd, it->type);
+        reserved.erase(it);
+        numPlayers++;
+        playersGauge().add();
+        persist();
+        LOG_INFO("Room %d: %s rejoined, waiting for %zu more", id, playerName.c_str(), reserved.size());
+        return true;
+    }
+    return false;
+}
+
+void Room::sendGameState(SocketFD fd) {
+    Player* player = getPlayer(fd);
+    if (!player)
+        return;
+    std::string rivalName = getRivalName(fd);
+    ChessType rivalType = reverse(player->type);
+    API::notifyPlayerInfo(fd, player->name, player->type, rivalName, rivalType);
+    API::sendChessBoard(fd, board, lastChess);
+    if (numPlayers == 2)
+        API::notifyRivalInfo(getRival(fd)->socketfd, player->name);
+
+    //人齐了，该走的一方从头开始计时
+    if (reserved.empty() && gameStatus == GAME_RUNNING)
+        startMoveClock();
+}
+
+//已经回来的玩家收到对手断开的通知，对局结束；一个人都没回来的房间直接回收
+void Room::expireReserved() {
+    if (reserved.empty() || flagShouldDelete)
+        return;
+    //没回来的一方算输，两个人都没回来就没有结果
+    if (gameStatus == GAME_RUNNING)
+        finishGame(reserved.size() == 1 ? reverse(reserved[0].type) : CHESS_NULL, GameRecord::REASON_DISCONNECT);
+    for (const Player& player : reserved) {
+        LOG_INFO("Room %d: %s did not rejoin in time", id, player.name.c_str());
+        if (numPlayers > 0)
+            broadcast(API::packDisconnect(player.name), -1);
+    }
+    reserved.clear();
+
+    if (numPlayers == 0) {
+        release();
+        return;
+    }
+    gameStatus = GAME_END;
+    lastChess = { 0, 0, CHESS_NULL };
+    persist();
+}
+
+std::string Room::getRivalName(SocketFD fd) const {
+    if (numPlayers >= 1 && player1.socketfd != fd)
+        return player1.name;
+    if (numPlayers == 2 && player2.socketfd != fd)
+        return player2.name;
+    if (!reserved.empty())
+        return reserved[0].name;
+    return "";
+}
+
+//服务器关闭前通知房间里的所有人，结束对局，之后的计时器到期什么都不做。socket由服务器统一关闭
+void Room::shutdown() {
+    if (gameStatus == GAME_RUNNING)
+        finishGame(CHESS_NULL, GameRecord::REASON_SHUTDOWN);
+    gameStatus = GAME_END;
+    ++clockGeneration;
+    broadcast(API::packServerShutdown(), -1);
 }
 //解析json消息，执行对应函数
 bool Room::parseJsonMsg(const Json::Value& root, SocketFD fd) {
-    if (root["type"].isNull())
+    //加入房间失败的连接在解绑前可能还会发来消息
+    if (root["type"].isNull() || !getPlayer(fd))
         return false;
     std::string msgType = root["type"].asString();//获取消息类型 "command" "response" "chat" "notify"
     
@@ -185,6 +496,17 @@ bool Room::parseJsonMsg(const Json::Value& root, SocketFD fd) {
 
     return false;
 }
+//解析观众发来的消息，观众只能发送chat类型的消息
+bool Room::parseWatcherMsg(const Json::Value& root, SocketFD fd) {
+    //类型检测
+    if (root["type"].isNull() || root["type"].asString() != "chat" ||
+            root["message"].isNull() || root["sender"].isNull()) {
+        return false;
+    }
+    //向棋手和其他的观众发送该消息
+    broadcast(API::pack(root), fd);
+    return true;
+}
 //玩家加入后游戏开始前，对应三种操作  准备 | 取消准备| 交换
 bool Room::processMsgTypeCmd(const Json::Value& root, SocketFD fd) {
     std::string cmd = root["cmd"].asString();
@@ -198,30 +520,35 @@ bool Room::processMsgTypeCmd(const Json::Value& root, SocketFD fd) {
 }
 
 bool Room::processMsgTypeResponse(const Json::Value& root, SocketFD fd) {
+    Player* rival = getRival(fd);
+    if (numPlayers != 2 || !rival)
+        return false;
     std::string res_cmd = root["res_cmd"].asString();
-    if (res_cmd == "prepare") {
-        if (root["accept"].isNull())
+    //客户端回应交换用的是exchange，以前这里只认prepare，两个都当作交换的回应
+    if (res_cmd == "exchange" || res_cmd == "prepare") {
+        //只能回应对手发来、还没有回应过的交换请求，对局中不能换颜色，否则落子的顺序就乱了
+        if (root["accept"].isNull() || gameStatus == GAME_RUNNING || exchangeFrom != rival->socketfd) {
+            LOG_WARN("Room %d: ignored an exchange response without a pending request", id);
             return false;
+        }
+        exchangeFrom = -1;
 
         //同一交换
         if (root["accept"].asBool()) {
             ChessType tmp = player1.type;
             player1.type = player2.type;
             player2.type = tmp;
+            persist();
         }
     }
-    return API::forward(getRival(fd)->socketfd, root);
+    return API::forward(rival->socketfd, root);
 }
 
 bool Room::processMsgTypeChat(const Json::Value& root, SocketFD fd) {
 
     //发送消息给房间内其他人
-    for (auto& watcher : watchers) {
-        if (watcher.socketfd != fd) {
-            API::forward(watcher.socketfd, root);
-        }
-    }
-    return API::forward(getRival(fd)->socketfd, root); 
+    broadcast(API::pack(root), fd);
+    return true;
 }
 
 /*
@@ -263,8 +590,10 @@ bool Room::processMsgTypeNotify(const Json::Value& root, SocketFD fd) {
 
 bool Room::processNotifyRivalInfo(const Json::Value& root, SocketFD fd) {
     Player* player = getPlayer(fd);
-    if (!root["player_name"].isNull())
+    if (!root["player_name"].isNull()) {
         player->name = root["player_name"].asString();
+        persist();
+    }
 
     return API::forward(getRival(fd)->socketfd, root);
 }
@@ -278,25 +607,23 @@ bool Room::processPrepareGame(const Json::Value& root, SocketFD fd) {
         player->prepare = true;
         //都准备好了
         if (player1.prepare && player2.prepare) {
-            gameStatus = GAME_RUNNING;
-            initChessBoard();
-            lastChess = { 0, 0, CHESS_NULL };
+            beginGame();
             player1.prepare = false;
             player2.prepare = false;
 
             //通知房间内所有人游戏开始了
-            API::notifyGameStart(fd);
-            for (auto& watcher : watchers)
-                API::notifyGameStart(watcher.socketfd);
-            return API::notifyGameStart(getRival(fd)->socketfd);
+            broadcast(API::packGameStart(), -1);
+            startMoveClock();
+            persist();
+            return true;
         }
         //对手还没准备
         else {
             gameStatus = GAME_PREPARE;
+            persist();
             API::responsePrepare(fd, STATUS_OK, "OK");
-            for (auto& watcher : watchers)
-                API::forward(watcher.socketfd, root);
-            return API::forward(getRival(fd)->socketfd, root);
+            broadcast(API::pack(root), fd);
+            return true;
         }
     }
     //人数不够
@@ -308,56 +635,132 @@ bool Room::processPrepareGame(const Json::Value& root, SocketFD fd) {
     }
 }
 
-bool Room::processCancelPrepareGame(const Json::Value& root, SocketFD fd) {
+bool Room::processCancelPrepareGame(const Json::Value&, SocketFD fd) {
     getPlayer(fd)->prepare = false;
+    persist();
 
     //通知所有人
-    for (auto& watcher : watchers)
-        API::notifyGameCancelPrepare(watcher.socketfd);
-    return  API::notifyGameCancelPrepare(getRival(fd)->socketfd);
+    broadcast(API::packGameCancelPrepare(), fd);
+    return true;
 }
 
 
 bool Room::processNewPiece(const Json::Value& root, SocketFD fd) {
     if (root["row"].isNull() || root["col"].isNull() || root["chess_type"].isNull())
         return false;
-    int row = root["row"].asInt();
-    int col = root["col"].asInt();
-    int chessType = root["chess_type"].asInt();
-    setPiece(row, col, ChessType(chessType));   //落子
-    lastChess = { row, col, chessType };
-    //向房间内观众发送落子信息
-    for (auto& watcher : watchers) {
-        API::notifyNewPiece(watcher.socketfd, row, col, chessType);
-    }
-    //向对手发送
-    return API::notifyNewPiece(getRival(fd)->socketfd, row, col, chessType);
+    return placePiece(root["row"].asInt(), root["col"].asInt(), root["chess_type"].asInt(), fd);
 }
 
-bool Room::processGameOver(const Json::Value& root, SocketFD fd) {
-    if (root["game_result"].isNull())
+bool Room::placePiece(int row, int col, int chessType, SocketFD fd) {
+    Player* player = getPlayer(fd);
+    if (!player)
         return false;
 
-    if (root["game_result"].asString() == "win") {
-        if (root["chess_type"].isNull())
-            return false;
-        //黑棋赢了还是白棋
-        ChessType winChessType = ChessType(root["chess_type"].asInt());
+    //不再相信客户端：游戏要在进行中，对手已经回到房间，轮到该玩家，颜色是他自己的，位置在棋盘内且没有棋子
+    if (gameStatus != GAME_RUNNING || !reserved.empty() || player->type != turn || chessType != player->type ||
+            row < 0 || row >= BitBoard::SIZE || col < 0 || col >= BitBoard::SIZE ||
+            !board.isEmpty(row, col)) {
+        LOG_WARN("Room %d: rejected move from %s: (%d, %d)", id, player->name.c_str(), row, col);
+        return false;
     }
-    else {  //Draw
 
+    setPiece(row, col, ChessType(chessType));   //落子
+    lastChess = { row, col, chessType };
+    game.moves.push_back(uint8_t(row * BitBoard::SIZE + col));
+    turn = reverse(turn);
+    //向对手和房间内观众发送落子信息，只序列化一次
+    broadcast(API::packNewPiece(row, col, chessType), fd);
+
+    static Histogram& fanoutLatency = Metrics::histogram("gobang_move_fanout_seconds",
+            "Time from reading a move to queueing it for the last receiver in the room");
+    fanoutLatency.record(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - receivedAt).count());
+
+    //胜负由服务器判断，通知房间内所有人
+    if (winDetector.place(board, row, col, ChessType(chessType)) >= 5) {
+        finishGame(chessType, GameRecord::REASON_FIVE);
+        broadcast(API::packGameOver(chessType), -1);
+    }
+    else if (board.count() == BitBoard::SIZE * BitBoard::SIZE) {
+        finishGame(CHESS_NULL, GameRecord::REASON_DRAW);
+        broadcast(API::packGameOver(CHESS_NULL), -1);
+    }
+    else {
+        startMoveClock();
     }
+    persist();
+    return true;
+}
 
-    gameStatus = GAME_END;
-    std::cout << "game over" << std::endl;
+//计时器不取消：每次重新计时都换一个代数，旧的计时器到期后发现代数不对就直接返回。
+//计时器只持有房间的弱引用，房间释放后到期的计时器什么都不做
+void Room::startMoveClock() {
+    if (!loop || moveTimeoutMs <= 0)
+        return;
+
+    int generation = ++clockGeneration;
+    std::weak_ptr<Room> weak = shared_from_this();
+    EventLoop* timerLoop = loop;
+    int timeout = moveTimeoutMs;
+    loop->queueInLoop([timerLoop, timeout, weak, generation](){
+        timerLoop->runAfter(timeout, [weak, generation](){
+            std::shared_ptr<Room> room = weak.lock();
+            if (room)
+                room->post([r = room.get(), generation](){ r->handleMoveTimeout(generation); });
+        });
+    });
+}
+
+void Room::handleMoveTimeout(int generation) {
+    if (generation != clockGeneration || gameStatus != GAME_RUNNING)
+        return;
+
+    static Counter& moveTimeouts = Metrics::counter("gobang_timeouts_total",
+            "Connections closed or games ended by a timeout", "kind=\"move\"");
+    moveTimeouts.add();
+
+    //超时的是该走的一方，对手获胜
+    LOG_INFO("Room %d: %s ran out of time", id, turn == player1.type ? player1.name.c_str() : player2.name.c_str());
+    finishGame(reverse(turn), GameRecord::REASON_TIMEOUT);
+    persist();
+    broadcast(API::packGameOver(reverse(turn), "timeout"), -1);
+}
+
+//客户端仍然会发送game_over，但胜负已经由placePiece判断过了，这里只检查双方的结论是否一致
+bool Room::processGameOver(const Json::Value& root, SocketFD) {
+    if (root["game_result"].isNull())
+        return false;
+
+    if (gameStatus != GAME_END)
+        LOG_WARN("Room %d: ignored game_over from client, game is still running", id);
+    else
+        LOG_DEBUG("Room %d: game over", id);
     return true;
 }
 
 bool Room::processExchangeChessType(const Json::Value& root, SocketFD fd) {
-    if (numPlayers != 2)
+    Player* rival = getRival(fd);
+    if (numPlayers != 2 || !rival || gameStatus == GAME_RUNNING)
         return false;
+    //记下是谁发起的，对手的回应要和它对上
+    exchangeFrom = fd;
     //通知对手 ll
-    return API::forward(getRival(fd)->socketfd, root);
+    return API::forward(rival->socketfd, root);
+}
+
+void Room::broadcast(const Packet& packet, SocketFD except) {
+    if (numPlayers >= 1 && player1.socketfd != except)
+        sendPacket(packet, player1.socketfd);
+    if (numPlayers == 2 && player2.socketfd != except)
+        sendPacket(packet, player2.socketfd);
+    broadcastToWatchers(packet, except);
+}
+
+void Room::broadcastToWatchers(const Packet& packet, SocketFD except) {
+    for (auto& watcher : watchers) {
+        if (watcher.socketfd != except)
+            sendPacket(packet, watcher.socketfd);
+    }
 }
 
 Player* Room::getPlayer(SocketFD fd) {
@@ -1,20 +1,35 @@
 #pragma once
 
 #include "base.h"
+#include "bitboard.h"
+#include "game_log.h"
+#include "win_detector.h"
 #include "player.h"
+#include "room_store.h"
 #include "socket_func.h"
+#include "strand.h"
 #include "thread_pool.h"
 #include "jsoncpp/json/json.h"
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+class EventLoop;
+
 #define MAX_NUM_WATCHERS 20
 
 
-class Room {
+//房间由shared_ptr持有：目录、连接和排队中的任务各持有一份引用，最后一份引用释放时房间随之释放
+class Room : public std::enable_shared_from_this<Room> {
 public:
-    Room();
+    typedef std::function<void(const std::vector<SocketFD>& watchers)> EmptyCallback;
+
+    explicit Room(ThreadPool& pool);
     ~Room() {}
 
 public:
@@ -27,12 +42,23 @@ public:
 
     int getNumPlayers() const { return numPlayers; }                        //获取房间玩家数量
     int getNumWatchers() const { return watchers.size(); }                  //获取观战人数
-    bool isFull() const { return watchers.size() >= MAX_NUM_WATCHERS; }     //房间是否满了
+    bool isFull() const { return maxWatchers > 0 && watchers.size() >= size_t(maxWatchers); }  //观众是否满了
 
     void addPlayer(const std::string& name, SocketFD fd);                   //添加一名玩家
-    void addWatcher(const std::string& name, SocketFD fd);                  //添加一名观众
+    void addWatcher(const std::string& name, SocketFD fd, bool moveList);   //添加一名观众，moveList为true时按落子顺序发送棋局
     void quitPlayer(SocketFD fd);                                           //踢出一名玩家
     void quitWatcher(SocketFD fd);                                          //踢出一名观众
+    void shutdown();                                                        //服务器即将关闭
+    Json::Value snapshot() const;                                           //热升级时交给新进程的状态，fd为旧进程中的编号
+    //在新进程中恢复状态，fds把旧进程的fd换成新进程的fd；对局中的房间重新开始计时，不通知任何人
+    void restore(const Json::Value& root, const std::unordered_map<int, SocketFD>& fds);
+    //崩溃后按状态文件恢复：玩家都还没有连上，座位留给他们，按名字重新加入
+    void recover(const RoomRecord& record);
+    bool rejoin(const std::string& name, SocketFD fd);                      //回到留给这个名字的座位，没有时返回false
+    void sendGameState(SocketFD fd);                                        //把双方信息和棋盘发给重新加入的玩家，人齐了继续计时
+    void expireReserved();                                                  //等不到的玩家不再等，座位让出来
+    int getNumReserved() const { return reserved.size(); }                  //还在等待重新加入的玩家数
+    std::string getRivalName(SocketFD fd) const;                            //另一个座位上的玩家，可能还没有重新加入
 
     Player& getPlayer1() { return player1; }                                //获取玩家1
     Player& getPlayer2() { return player2; }                                //获取玩家2
@@ -40,11 +66,34 @@ public:
     Player* getRival(int my_fd);                                            //获取对手
 
     bool shouldDelete() const { return flagShouldDelete; }                  //是否应该删除房间
+    void setOnEmpty(EmptyCallback func) { onEmpty = std::move(func); }      //最后一名玩家退出时调用，参数为剩下的观众
+    void setMoveTimeout(EventLoop* loopIn, int ms) { loop = loopIn; moveTimeoutMs = ms; }  //每步棋的时限，计时器在loop上
+    void setStore(RoomStore* storeIn) { store = storeIn; }                 //状态变化时写到状态文件，为空时不写
+    void setGameLog(GameLog* logIn) { gameLog = logIn; }                    //对局结束时写到对局日志，为空时不写
+    void setMaxWatchers(int n) { maxWatchers = n; }                         //观众上限，0表示不限制；更多的观众通过中继观战
+
+    void post(std::function<void()> task);                                  //投递任务，房间的所有操作都要通过这里执行
+    size_t getQueueDepth() const { return strand->queueDepth(); }           //等待执行的任务数
+
+    bool parseJsonMsg(const Json::Value& root, SocketFD fd);                //解析玩家发来的json消息
+    bool parseWatcherMsg(const Json::Value& root, SocketFD fd);             //解析观众发来的json消息
+    bool placePiece(int row, int col, int chessType, SocketFD fd);          //玩家落子，json和二进制消息都走这里，由服务器判断是否合法和胜负
+    void setReceivedAt(std::chrono::steady_clock::time_point t) { receivedAt = t; }  //正在处理的消息被读到的时间
 
 private:
     void setPiece(int row, int col, ChessType type);                        //放置棋子
-
-    bool parseJsonMsg(const Json::Value& root, SocketFD fd);                //解析json消息
+    void rebuildWinDetector();                                              //按棋盘重新计算连五的状态
+    void persist();                                                         //把当前状态写到状态文件，状态版本加一
+    void sendJoinPayload(SocketFD fd, bool moveList);                       //发给新观众双方信息和棋局，每个状态版本最多编码一次
+    void release();                                                         //没有玩家了，标记删除并通知服务器回收
+    void beginGame();                                                       //双方都准备好了，开始新的一局
+    void finishGame(int winner, GameRecord::Reason reason);                 //对局结束，写到对局日志
+    void nameSeats();                                                       //按颜色记下双方的名字，可能有人还没有重新加入
+    std::vector<const Player*> getSeats() const;                            //房间里的玩家，加上还没有重新加入的
+    void broadcast(const Packet& packet, SocketFD except);                  //发给房间内除except外的所有人
+    void broadcastToWatchers(const Packet& packet, SocketFD except = -1);   //发给所有观众
+    void startMoveClock();                                                  //开始为当前该走的一方计时
+    void handleMoveTimeout(int generation);                                 //计时到了还没落子，判负
 
     bool processMsgTypeCmd(const Json::Value& root, SocketFD fd);           //处理控制命令
     bool processMsgTypeResponse(const Json::Value& root, SocketFD fd);      //处理响应
@@ -66,12 +115,22 @@ private:
     };
 
 private:
-    ThreadPool pool;                    //线程池，一个房间一个线程池
-    bool flagShouldDelete = false;      //退出标识
-
-    int chessPieces[15][15];            //棋盘
+    std::shared_ptr<Strand> strand;     //串行执行器，房间的消息在共享线程池中按顺序执行
+    std::atomic<bool> flagShouldDelete; //退出标识
+    EmptyCallback onEmpty;              //房间变空时通知服务器回收
+    EventLoop* loop = nullptr;          //每步计时用的事件循环，为空时不计时
+    int moveTimeoutMs = 0;
+    int clockGeneration = 0;            //每次重新计时加一，之前的计时器到期后发现不一致就什么都不做
+    RoomStore* store = nullptr;         //崩溃恢复用的状态文件
+    GameLog* gameLog = nullptr;         //对局日志
+
+    BitBoard board;                     //棋盘
+    WinDetector winDetector;            //增量判断连五
+    ChessType turn = CHESS_BLACK;       //轮到哪一方落子，黑棋先手
     GameStatus gameStatus = GAME_END;   //当前游戏状态
     ChessPieceInfo lastChess;           //上次落子
+    GameRecord game;                    //当前这一局的双方和落子顺序，结束后保留到下一局开始
+    std::chrono::steady_clock::time_point receivedAt;  //用于统计从收到落子到广播完成的延迟
 
     int id = -1;                        //房间号
     std::string name;                   //房间名字
@@ -79,7 +138,20 @@ private:
 
     Player player1;                     //玩家1
     Player player2;                     //玩家2
+    std::vector<Player> reserved;       //崩溃前在房间里、还没有重新加入的玩家，没有socket
+    SocketFD exchangeFrom = -1;         //发起交换黑白、还没有得到回应的玩家
 
     std::vector<Watcher> watchers;      //观众
+    int maxWatchers = MAX_NUM_WATCHERS;
+
+    //观众加入时要发的内容按状态版本缓存，热门对局短时间内涌进大量观众时只编码一次，之后每人只是排队共享的body
+    struct JoinPayload {
+        uint64_t version = 0;           //编码时的状态版本，0表示还没有编码过
+        Packet playerInfo;
+        Packet chessBoard;              //老客户端用的整个棋盘
+        Packet moveList;                //落子顺序
+    };
+    uint64_t stateVersion = 1;          //每次落子、玩家变化都加一
+    JoinPayload joinPayload;
 };
 
@@ -0,0 +1,160 @@
+#include "room_directory.h"
+
+#include "room.h"
+
+
+IdAllocator::IdAllocator(int minId, int maxId) : minId(minId), maxId(maxId) {
+    //最底层：有效的房间号置1
+    size_t bits = capacity();
+    levels.emplace_back((bits + 63) / 64, 0);
+    for (size_t i = 0; i < bits; ++i)
+        levels[0][i / 64] |= uint64_t(1) << (i % 64);
+
+    //逐层向上汇总，直到只剩一个字
+    while (levels.back().size() > 1) {
+        const std::vector<uint64_t>& lower = levels.back();
+        std::vector<uint64_t> upper((lower.size() + 63) / 64, 0);
+        for (size_t i = 0; i < lower.size(); ++i) {
+            if (lower[i])
+                upper[i / 64] |= uint64_t(1) << (i % 64);
+        }
+        levels.push_back(std::move(upper));
+    }
+}
+
+int IdAllocator::allocate() {
+    if (levels.back()[0] == 0)
+        return -1;
+
+    //从顶层往下，每层取最低的空闲位
+    size_t index = 0;
+    for (size_t level = levels.size(); level-- > 0; )
+        index = index * 64 + __builtin_ctzll(levels[level][index]);
+
+    take(index);
+    return minId + int(index);
+}
+
+bool IdAllocator::reserve(int id) {
+    if (id < minId || id > maxId)
+        return false;
+    size_t index = size_t(id - minId);
+    if (!(levels[0][index / 64] & (uint64_t(1) << (index % 64))))
+        return false;
+    take(index);
+    return true;
+}
+
+//清掉这一位，如果所在的字变成0，上一层对应的位也要清掉
+void IdAllocator::take(size_t pos) {
+    for (size_t level = 0; level < levels.size(); ++level) {
+        uint64_t& word = levels[level][pos / 64];
+        word &= ~(uint64_t(1) << (pos % 64));
+        if (word)
+            break;
+        pos /= 64;
+    }
+}
+
+void IdAllocator::release(int id) {
+    if (id < minId || id > maxId)
+        return;
+
+    //置位，如果所在的字原来是0，上一层对应的位也要置上
+    size_t pos = size_t(id - minId);
+    for (size_t level = 0; level < levels.size(); ++level) {
+        uint64_t& word = levels[level][pos / 64];
+        bool wasEmpty = (word == 0);
+        word |= uint64_t(1) << (pos % 64);
+        if (!wasEmpty)
+            break;
+        pos /= 64;
+    }
+}
+
+
+RoomDirectory::RoomDirectory(int minId, int maxId) : count(0), ids(minId, maxId) {}
+
+void RoomDirectory::setIdRange(int minId, int maxId) {
+    std::lock_guard<std::mutex> lock(idMutex);
+    ids = IdAllocator(minId, maxId);
+}
+
+int RoomDirectory::add(const std::shared_ptr<Room>& room) {
+    int id;
+    {
+        std::lock_guard<std::mutex> lock(idMutex);
+        id = ids.allocate();
+    }
+    if (id < 0)
+        return -1;
+
+    room->setId(id);
+    Shard& shard = shardOf(id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.rooms[id] = room;
+    count.fetch_add(1, std::memory_order_relaxed);
+    return id;
+}
+
+bool RoomDirectory::insert(int id, const std::shared_ptr<Room>& room) {
+    {
+        std::lock_guard<std::mutex> lock(idMutex);
+        if (!ids.reserve(id))
+            return false;
+    }
+
+    room->setId(id);
+    Shard& shard = shardOf(id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.rooms[id] = room;
+    count.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+std::shared_ptr<Room> RoomDirectory::find(int id) {
+    Shard& shard = shardOf(id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.rooms.find(id);
+    return it == shard.rooms.end() ? std::shared_ptr<Room>() : it->second;
+}
+
+std::shared_ptr<Room> RoomDirectory::remove(int id) {
+    std::shared_ptr<Room> room;
+    {
+        Shard& shard = shardOf(id);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.rooms.find(id);
+        if (it == shard.rooms.end())
+            return room;
+        room = std::move(it->second);
+        shard.rooms.erase(it);
+        count.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    //房间已经不在目录中，之后才能把房间号交给新房间
+    std::lock_guard<std::mutex> lock(idMutex);
+    ids.release(id);
+    return room;
+}
+
+std::vector< std::shared_ptr<Room> > RoomDirectory::snapshot() {
+    std::vector< std::shared_ptr<Room> > result;
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto& item : shard.rooms)
+            result.push_back(item.second);
+    }
+    return result;
+}
+
+void RoomDirectory::clear() {
+    std::vector<int> idsInUse;
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto& item : shard.rooms)
+            idsInUse.push_back(item.first);
+    }
+    for (int id : idsInUse)
+        remove(id);
+}
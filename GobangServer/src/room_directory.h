@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#define DEFAULT_MIN_ROOM_ID     1000
+#define DEFAULT_MAX_ROOM_ID     9999
+#define WIDE_MIN_ROOM_ID        100000      //开启更大的房间号范围时使用6位房间号
+#define WIDE_MAX_ROOM_ID        999999
+
+class Room;
+
+
+//房间号分配器：分层位图，最底层每一位表示一个房间号是否空闲，上一层的每一位表示下一层对应的字是否还有空闲位，
+//分配和回收都只需要从顶层走到底层，和已经分配的数量无关
+class IdAllocator {
+public:
+    IdAllocator(int minId, int maxId);
+
+public:
+    int allocate();                     //分配最小的空闲房间号，用完时返回-1
+    bool reserve(int id);               //占用指定的房间号，已经被占用或超出范围时返回false
+    void release(int id);               //回收房间号
+    size_t capacity() const { return size_t(maxId - minId + 1); }
+    int getMinId() const { return minId; }
+    int getMaxId() const { return maxId; }
+
+private:
+    void take(size_t index);
+
+    std::vector< std::vector<uint64_t> > levels;    //levels[0]是最底层，最后一层只有一个字
+    int minId;
+    int maxId;
+};
+
+
+//按房间号查找房间，分成多个带锁的分片，创建、加入、观战时不同房间互不阻塞
+class RoomDirectory {
+public:
+    RoomDirectory(int minId = DEFAULT_MIN_ROOM_ID, int maxId = DEFAULT_MAX_ROOM_ID);
+
+public:
+    void setIdRange(int minId, int maxId);          //只能在还没有房间时调用
+    int getMinId() const { return ids.getMinId(); }
+    int getMaxId() const { return ids.getMaxId(); }
+
+    int add(const std::shared_ptr<Room>& room);     //分配房间号并登记，房间号用完时返回-1
+    bool insert(int id, const std::shared_ptr<Room>& room);    //用指定的房间号登记，热升级时恢复房间用
+    std::shared_ptr<Room> find(int id);
+    std::shared_ptr<Room> remove(int id);           //注销房间并回收房间号，返回被注销的房间
+    size_t size() const { return count.load(std::memory_order_relaxed); }
+    std::vector< std::shared_ptr<Room> > snapshot();        //当前所有房间
+    void clear();                                   //注销所有房间
+
+private:
+    static const int NUM_SHARDS = 16;
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map< int, std::shared_ptr<Room> > rooms;
+    };
+
+    Shard& shardOf(int id) { return shards[unsigned(id) % NUM_SHARDS]; }
+
+private:
+    Shard shards[NUM_SHARDS];
+    std::atomic<size_t> count;
+
+    std::mutex idMutex;
+    IdAllocator ids;
+};
@@ -0,0 +1,182 @@
+#include "room_store.h"
+#include "logger.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char STORE_MAGIC[8] = { 'G', 'O', 'B', 'A', 'N', 'G', 'R', 'S' };
+static const uint32_t STORE_VERSION = 1;
+static const int MAX_READ_RETRIES = 100;
+
+
+bool RoomStore::open(const std::string& path, int minIdIn, int maxIdIn) {
+    close();
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("open state file %s error: %s(errno: %d)", path.c_str(), strerror(errno), errno);
+        return false;
+    }
+
+    size_t numSlots = size_t(maxIdIn - minIdIn + 1);
+    mappedSize = sizeof(Header) + numSlots * sizeof(Slot);
+    //大小或者头部对不上(换了房间号范围、升级了格式)就清空重建
+    Header header;
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+        st.st_size = 0;
+    bool fresh = size_t(st.st_size) != mappedSize ||
+        pread(fd, &header, sizeof(header), 0) != ssize_t(sizeof(header)) ||
+        memcmp(header.magic, STORE_MAGIC, sizeof(STORE_MAGIC)) != 0 || header.version != STORE_VERSION ||
+        header.slotSize != sizeof(Slot) || header.minId != minIdIn || header.maxId != maxIdIn;
+    if (fresh && st.st_size > 0)
+        LOG_WARN("State file %s has a different layout, discarding it", path.c_str());
+    //文件是稀疏的，只有用到的槽位占磁盘
+    if (fresh && (ftruncate(fd, 0) == -1 || ftruncate(fd, off_t(mappedSize)) == -1)) {
+        LOG_ERROR("ftruncate state file error: %s(errno: %d)", strerror(errno), errno);
+        close();
+        return false;
+    }
+
+    base = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        LOG_ERROR("mmap state file error: %s(errno: %d)", strerror(errno), errno);
+        base = nullptr;
+        close();
+        return false;
+    }
+    if (fresh) {
+        memcpy(header.magic, STORE_MAGIC, sizeof(STORE_MAGIC));
+        header.version = STORE_VERSION;
+        header.slotSize = sizeof(Slot);
+        header.minId = minIdIn;
+        header.maxId = maxIdIn;
+        memset(header.padding, 0, sizeof(header.padding));
+        memcpy(base, &header, sizeof(header));
+    }
+
+    minId = minIdIn;
+    maxId = maxIdIn;
+    slots = (Slot*)((char*)base + sizeof(Header));
+    return true;
+}
+
+//munmap不会丢数据，页缓存里的内容照样写回文件
+void RoomStore::close() {
+    if (base)
+        munmap(base, mappedSize);
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    base = nullptr;
+    slots = nullptr;
+    mappedSize = 0;
+}
+
+RoomStore::Slot* RoomStore::slotOf(int id) const {
+    if (!slots || id < minId || id > maxId)
+        return nullptr;
+    return &slots[id - minId];
+}
+
+//崩溃时写到一半的槽位序号是奇数，接着用这个奇数开始写，写完仍然是偶数
+static uint32_t beginWrite(std::atomic<uint32_t>& sequence) {
+    uint32_t begin = sequence.load(std::memory_order_relaxed) | 1;
+    sequence.store(begin, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    return begin;
+}
+
+void RoomStore::save(const RoomRecord& record) {
+    Slot* slot = slotOf(record.id);
+    if (!slot)
+        return;
+    uint32_t begin = beginWrite(slot->sequence);
+    memcpy(&slot->record, &record, sizeof(record));
+    slot->sequence.store(begin + 1, std::memory_order_release);
+}
+
+void RoomStore::erase(int id) {
+    Slot* slot = slotOf(id);
+    if (!slot)
+        return;
+    uint32_t begin = beginWrite(slot->sequence);
+    slot->record.id = 0;
+    slot->sequence.store(begin + 1, std::memory_order_release);
+}
+
+//once为true时只读一次：崩溃后没有写者，奇数的序号不会再变
+bool RoomStore::read(const Slot& slot, RoomRecord& record, bool once) const {
+    for (int i = 0; i < MAX_READ_RETRIES; ++i) {
+        uint32_t before = slot.sequence.load(std::memory_order_acquire);
+        if (before & 1) {
+            if (once)
+                return false;
+            continue;
+        }
+        memcpy(&record, &slot.record, sizeof(record));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) == before)
+            return true;
+        if (once)
+            return false;
+    }
+    return false;
+}
+
+bool RoomStore::load(int id, RoomRecord& record) const {
+    Slot* slot = slotOf(id);
+    return slot && read(*slot, record, false) && record.id == id;
+}
+
+//只看文件中写过数据的部分，房间号范围很大时不用把整个文件读进内存。文件系统不支持SEEK_DATA时整个文件都算数据
+void RoomStore::forEachUsed(const std::function<void(int id, Slot& slot)>& func) const {
+    off_t end = off_t(mappedSize);
+    off_t pos = sizeof(Header);
+    while (slots && pos < end) {
+        off_t dataBegin = lseek(fd, pos, SEEK_DATA);
+        if (dataBegin < 0)
+            break;
+        off_t dataEnd = lseek(fd, dataBegin, SEEK_HOLE);
+        if (dataEnd < 0 || dataEnd > end)
+            dataEnd = end;
+
+        size_t first = size_t(dataBegin - off_t(sizeof(Header))) / sizeof(Slot);
+        size_t last = (size_t(dataEnd - off_t(sizeof(Header))) + sizeof(Slot) - 1) / sizeof(Slot);
+        for (size_t i = first; i < last && i < size_t(maxId - minId + 1); ++i) {
+            //没用过的槽位是全0
+            if (slots[i].sequence.load(std::memory_order_relaxed) != 0)
+                func(minId + int(i), slots[i]);
+        }
+        pos = dataEnd;
+    }
+}
+
+size_t RoomStore::forEach(const std::function<void(const RoomRecord&)>& func) const {
+    size_t torn = 0;
+    RoomRecord record;
+    forEachUsed([&](int id, Slot& slot){
+        if (!read(slot, record, true))
+            ++torn;
+        else if (record.id == id)
+            func(record);
+    });
+    return torn;
+}
+
+void RoomStore::clear() {
+    forEachUsed([this](int id, Slot&){ erase(id); });
+}
+
+void RoomStore::copyName(char* out, const std::string& name) {
+    size_t length = name.size() < STORE_NAME_LENGTH ? name.size() : STORE_NAME_LENGTH - 1;
+    memcpy(out, name.data(), length);
+    memset(out + length, 0, STORE_NAME_LENGTH - length);
+}
+
+std::string RoomStore::fitName(const std::string& name) {
+    return name.size() < STORE_NAME_LENGTH ? name : name.substr(0, STORE_NAME_LENGTH - 1);
+}
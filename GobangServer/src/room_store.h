@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <string>
+
+#define STORE_NAME_LENGTH   64          //名字按字节截断，包括结尾的0
+
+
+//一个房间的状态，固定大小，可以直接memcpy
+struct RoomRecord {
+    struct Seat {
+        char name[STORE_NAME_LENGTH];
+        int32_t type;
+        uint8_t prepare;
+        uint8_t padding[3];
+    };
+
+    int32_t id;                         //0表示空槽位
+    int32_t status;
+    int32_t turn;
+    int32_t lastRow;
+    int32_t lastCol;
+    int32_t lastType;
+    uint32_t moveNumber;                //moves中的步数
+    uint32_t numSeats;
+    int64_t startMs;                    //这一局开始的时间
+    uint64_t bits[8];                   //BitBoard::save的结果，恢复时和按moves重新下一遍的结果比较
+    uint8_t moves[225];                 //每步一个字节，同对局日志
+    char name[STORE_NAME_LENGTH];
+    Seat seats[2];
+};
+
+//崩溃恢复用的房间状态文件：文件映射到内存，每个房间号一个固定的槽位，房间每次状态变化时整个槽位重写一遍。
+//写入只是内存拷贝，不调用系统调用，进程崩溃后已经写入的页仍然在页缓存里，由内核写回文件。
+//每个槽位有一个序号(seqlock)：写之前加一变成奇数，写完再加一。读到奇数或者前后不一致说明正在写，
+//崩溃后读到奇数说明写到一半，这个槽位不能用
+class RoomStore {
+public:
+    RoomStore() {}
+    ~RoomStore() { close(); }
+    RoomStore(const RoomStore&) = delete;
+    RoomStore& operator=(const RoomStore&) = delete;
+
+public:
+    //打开或创建文件，房间号范围和文件里的不一致时清空重建
+    bool open(const std::string& path, int minId, int maxId);
+    void close();
+    bool isOpen() const { return slots != nullptr; }
+
+    //同一个房间号同一时间只能有一个线程写(房间的strand)，读可以在任意线程
+    void save(const RoomRecord& record);
+    void erase(int id);
+    bool load(int id, RoomRecord& record) const;            //空槽位或者一直读不到完整的数据时返回false
+    size_t forEach(const std::function<void(const RoomRecord&)>& func) const;   //遍历所有有效的房间，返回写坏了的槽位数
+    void clear();                                           //清空所有槽位，没有写者时调用
+
+    static void copyName(char* out, const std::string& name);      //截断后写入，保证以0结尾
+    static std::string fitName(const std::string& name);           //截断后的名字，恢复后按名字比较时用
+
+private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t slotSize;
+        int32_t minId;
+        int32_t maxId;
+        char padding[40];
+    };
+
+    struct alignas(64) Slot {
+        std::atomic<uint32_t> sequence;
+        uint32_t padding;
+        RoomRecord record;
+    };
+
+    Slot* slotOf(int id) const;
+    void forEachUsed(const std::function<void(int id, Slot& slot)>& func) const;
+    bool read(const Slot& slot, RoomRecord& record, bool once) const;
+
+private:
+    int fd = -1;
+    void* base = nullptr;
+    size_t mappedSize = 0;
+    Slot* slots = nullptr;
+    int minId = 0;
+    int maxId = -1;
+};
@@ -1,95 +1,123 @@
 #include "socket_func.h"
-#include <iostream>
+#include "connection.h"
+#include "logger.h"
+#include "metrics.h"
 #include <string>
 #include <cstring>
+#include <errno.h>
 
 #include "jsoncpp/json/json_features.h"
 #include "jsoncpp/json/writer.h"
 
 
+//序列化的结果直接作为排队的body，不再为了拼帧头拷贝一次
 bool sendJsonMsg(const Json::Value& jsonMsg, SocketFD fd) {
-    return sendJsonMsg(Json::FastWriter().write(jsonMsg), fd);
+    Packet packet;
+    packet.body = std::make_shared<const std::string>(Json::FastWriter().write(jsonMsg));
+    packet.statKind = MessageStats::classify(jsonMsg);
+    LOG_TRACE("Sending message: %s", packet.body->c_str());
+    return sendPacket(packet, fd);
 }
 
 
-//向指定fd发送消息，消息格式     |length:xxxx|string|   length后面的字段表示string的长度，客户端拿到后先将string转为Json对象，然后读取消息
+//向指定fd发送消息，文本帧格式     |length:xxxx|string|   length后面的字段表示string的长度，客户端拿到后先将string转为Json对象，然后读取消息
+//二进制帧格式   |kind|varint length|string|
 bool sendJsonMsg(const std::string& msg, SocketFD fd) {
     if (msg.empty())
         return false;
 
-    int len = msg.length();
-    std::string msgSend;
-    msgSend.reserve(12 + len);
-    msgSend += "length:";
-    msgSend += std::to_string(len);
-
-    //填充字节
-    if (len < 10)
-        msgSend += "   ";
-    else if (len < 100)
-        msgSend += "  ";
-    else if (len < 1000)
-        msgSend += " ";
-    msgSend += "\n";
-    msgSend += msg;
-
-    std::cout << "Sending message\n" << msgSend << std::endl;
-
-    send(fd, msgSend.c_str(), len + 12, 0);
-    return true;
+    LOG_TRACE("Sending message: %s", msg.c_str());
+    return sendFrame(fd, FRAME_JSON, msg.data(), msg.length());
+}
+
+//消息放进连接的发送队列就返回，不会阻塞调用者；连接已经不存在时返回false
+bool sendPacket(const Packet& packet, SocketFD fd) {
+    std::shared_ptr<Connection> conn = Connection::lookup(fd);
+    if (!conn)
+        return false;
+    if (packet.compactBody && conn->getFraming() == FRAMING_BINARY) {
+        MessageStats::sent(packet.statKind, packet.compactBody->length());
+        return conn->send(packet.compactKind, packet.compactBody);
+    }
+    if (!packet.body)
+        return false;
+    MessageStats::sent(packet.statKind, packet.body->length());
+    return conn->send(packet.kind, packet.body);
 }
 
+bool sendFrame(SocketFD fd, uint8_t kind, const char* body, size_t length) {
+    std::shared_ptr<Connection> conn = Connection::lookup(fd);
+    if (!conn)
+        return false;
+    MessageStats::sent(-1, length);
+    return conn->send(kind, std::make_shared<const std::string>(body, length));
+}
+
+
+//阻塞地接收len个字节，处理短读
+static int recvAll(SocketFD fd, char* buf, int len) {
+    int got = 0;
+    while (got < len) {
+        int n = recv(fd, buf + got, len - got, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        got += n;
+    }
+    return got;
+}
 
 int recvJsonMsg(Json::Value& root, SocketFD fd) {
-    char temp[8] = { 0 };
-    char lengthStr[5] = { 0 };
     char msgLengthInfo[13] = { 0 };
 
     //接收信息,先接受12个字节 length:(7字节) + int(4字节) + '\n'(1字节)
-    int n = recv(fd, msgLengthInfo, 12, 0);
-    if (n <= 0)
+    if (recvAll(fd, msgLengthInfo, 12) < 0)
         return -1;
-    if (n < 12)
-        return 0;
     //获取消息长度 （length:）
-    memcpy(temp, msgLengthInfo, 7);
-    memcpy(lengthStr, msgLengthInfo+7, 4);
-    temp[7] = 0;
-    if (strcmp(temp, "length:") != 0)
+    if (memcmp(msgLengthInfo, "length:", 7) != 0)
         return 0;
 
     int msgLength = 0;
-    sscanf(lengthStr, "%d", &msgLength);
-
-    char* jsonMsg = new char[msgLength+1];
-    jsonMsg[msgLength] = 0;
-    n = recv(fd, jsonMsg, msgLength, 0);
-    
-    bool ret = 0;
-
-    do {
-        if (n <= 0) {
-            ret = -1;
-            break;
-        }
-        if (n < msgLength) {
-            break;
-        }
-
-        Json::Reader reader;
-        //解析json消息到root里面去
-        if (!reader.parse(jsonMsg, root))
-            break;
-
-        ret = 1;
-    } while (false);
-
-    if (ret == 1) {
-        printf("Recieved message:\n%s\n", jsonMsg);
-    }
+    if (sscanf(msgLengthInfo + 7, "%4d", &msgLength) != 1 || msgLength < 0)
+        return 0;
 
-    delete[] jsonMsg;
-    return ret;
+    std::string jsonMsg(msgLength, '\0');
+    if (msgLength > 0 && recvAll(fd, &jsonMsg[0], msgLength) < 0)
+        return -1;
+
+    Json::Reader reader;
+    //解析json消息到root里面去
+    if (!reader.parse(jsonMsg, root))
+        return 0;
+
+    LOG_TRACE("Recieved message: %s", jsonMsg.c_str());
+    return 1;
+}
+
+bool setNonBlocking(SocketFD fd) {
+#ifdef _WIN32
+    u_long mode = 1;
+    return ioctlsocket(fd, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+        return false;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+bool setKeepAlive(SocketFD fd, int idleSec) {
+    int on = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, (const char*)&on, sizeof(on)) != 0)
+        return false;
+#ifdef TCP_KEEPIDLE
+    int interval = 5, count = 3;
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idleSec, sizeof(idleSec));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+#endif
+    return true;
 }
 
 //关闭连接
@@ -12,16 +12,40 @@
     #include <sys/types.h>
     #include <sys/socket.h>
     #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <fcntl.h>
     #define SocketFD int
 #endif
 
 
+#include "frame.h"
 #include "jsoncpp/json/json.h"
 
+#include <memory>
+#include <string>
 
+
+//编码好的消息，body只序列化一次，可以原样排队发给多个连接，帧头按每个连接的分帧方式单独生成
+struct Packet {
+    uint8_t kind = FRAME_JSON;
+    std::shared_ptr<const std::string> body;
+    //可选：发给二进制分帧连接时使用的更紧凑的编码，比如2字节的落子消息
+    uint8_t compactKind = 0;
+    std::shared_ptr<const std::string> compactBody;
+    int statKind = -1;          //MessageStats里的消息类型，-1表示other
+};
+
+
+//发送函数都只是把消息放进连接的发送队列，可以在任意线程调用
+bool sendFrame(SocketFD fd, uint8_t kind, const char* body, size_t length);
 bool sendJsonMsg(const std::string& msg, SocketFD fd);
+bool sendPacket(const Packet& packet, SocketFD fd);
 bool sendJsonMsg(const Json::Value& jsonMsg, SocketFD fd);
 
 int recvJsonMsg(Json::Value& root, SocketFD fd);
 
+bool setNonBlocking(SocketFD fd);
+//开启TCP keepalive，空闲idleSec秒后开始探测，探测3次每次间隔5秒
+bool setKeepAlive(SocketFD fd, int idleSec);
+
 void closeSocket(SocketFD fd);
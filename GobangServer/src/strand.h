@@ -0,0 +1,84 @@
+#ifndef STRAND_H
+#define STRAND_H
+
+#include "thread_pool.h"
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+
+//串行执行器：投递到同一个Strand的任务在共享线程池中按顺序、一次一个地执行，
+//所以一个房间的状态只会被一个线程访问，不需要加锁。
+//排进线程池的drain持有Strand的引用，任务中释放了Strand的拥有者也不会影响正在执行的drain
+class Strand : public std::enable_shared_from_this<Strand> {
+public:
+    explicit Strand(ThreadPool& pool) : pool(pool), depth(0), running(false) {}
+
+    void post(std::function<void()> task);
+
+    // number of tasks waiting to run (including the one being executed)
+    size_t queueDepth() const { return depth.load(std::memory_order_relaxed); }
+
+private:
+    void drain();
+
+private:
+    // run at most this many tasks before giving the worker back to other strands
+    static const int MAX_BATCH = 64;
+
+    ThreadPool& pool;
+    std::mutex mutex;
+    std::deque< std::function<void()> > tasks;
+    std::atomic<size_t> depth;
+    bool running;
+};
+
+inline void Strand::post(std::function<void()> task) {
+    bool schedule = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+        depth.fetch_add(1, std::memory_order_relaxed);
+        if (!running) {
+            running = true;
+            schedule = true;
+        }
+    }
+    if (schedule) {
+        std::shared_ptr<Strand> self = shared_from_this();
+        pool.enqueue([self](){ self->drain(); });
+    }
+}
+
+inline void Strand::drain() {
+    for (int i = 0; i < MAX_BATCH; ++i) {
+        std::function<void()> task;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (tasks.empty()) {
+                running = false;
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+        depth.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    //还有任务，重新排队，让其他房间也有机会执行
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (tasks.empty()) {
+            running = false;
+            return;
+        }
+    }
+    std::shared_ptr<Strand> self = shared_from_this();
+    pool.enqueue([self](){ self->drain(); });
+}
+
+#endif
@@ -19,6 +19,10 @@ public:
     template<class F, class... Args>
     auto enqueue(F&& f, Args&&... args) 
         -> std::future<typename std::result_of<F(Args...)>::type>;
+    //等待执行的任务数
+    size_t queueSize();
+    //执行完队列中剩下的任务后结束所有工作线程
+    void shutdown();
     ~ThreadPool();
 private:
     // need to keep track of threads so we can join them
@@ -34,12 +38,13 @@ private:
     //条件变量
     std::condition_variable condition;
     bool stop;
+    bool joined;
 };
  
 // the constructor just launches some amount of workers
 //构造指定个数个线程thread，然后指定thread的回调函数
 inline ThreadPool::ThreadPool(size_t threads)
-    :   stop(false)
+    :   stop(false), joined(false)
 {
     for(size_t i = 0;i<threads;++i)
         workers.emplace_back(
@@ -66,6 +71,12 @@ inline ThreadPool::ThreadPool(size_t threads)
         );
 }
 
+inline size_t ThreadPool::queueSize()
+{
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    return tasks.size();
+}
+
 // add new work item to the pool
 template<class F, class... Args>
 auto ThreadPool::enqueue(F&& f, Args&&... args) 
@@ -81,8 +92,9 @@ auto ThreadPool::enqueue(F&& f, Args&&... args)
     {
         std::unique_lock<std::mutex> lock(queue_mutex);
 
-        // don't allow enqueueing after stopping the pool
-        if(stop)
+        // don't allow enqueueing after stopping the pool,
+        // running tasks may still enqueue follow-up work while shutdown() drains the queue
+        if(joined)
             throw std::runtime_error("enqueue on stopped ThreadPool");
 
         tasks.emplace([task](){ (*task)(); });
@@ -91,8 +103,8 @@ auto ThreadPool::enqueue(F&& f, Args&&... args)
     return res;
 }
 
-// the destructor joins all threads
-inline ThreadPool::~ThreadPool()
+// finish the queued tasks and join all threads, enqueue throws afterwards
+inline void ThreadPool::shutdown()
 {
     {
         std::unique_lock<std::mutex> lock(queue_mutex);
@@ -100,7 +112,16 @@ inline ThreadPool::~ThreadPool()
     }
     condition.notify_all();
     for(std::thread &worker: workers)
-        worker.join();
+        if(worker.joinable())
+            worker.join();
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    joined = true;
+}
+
+// the destructor joins all threads
+inline ThreadPool::~ThreadPool()
+{
+    shutdown();
 }
 
 #endif
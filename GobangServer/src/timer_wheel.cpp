@@ -0,0 +1,201 @@
+#include "timer_wheel.h"
+
+#include <utility>
+
+
+TimerWheel::TimerWheel(int tickMs) :
+    tickMs(tickMs > 0 ? tickMs : 1)
+{
+    for (uint32_t& head : heads)
+        head = NIL;
+}
+
+TimerWheel::TimerId TimerWheel::add(int delayMs, Callback func) {
+    uint64_t ticks = delayMs <= 0 ? 1 : (uint64_t(delayMs) + tickMs - 1) / tickMs;
+    if (ticks > MAX_TICKS)
+        ticks = MAX_TICKS;
+
+    uint32_t index = allocNode();
+    Node& node = nodes[index];
+    node.expire = current + ticks;
+    node.func = std::move(func);
+    node.active = true;
+    place(index);
+    count++;
+    return (uint64_t(node.generation) << 32) | index;
+}
+
+bool TimerWheel::cancel(TimerId id) {
+    uint32_t index = uint32_t(id);
+    uint32_t generation = uint32_t(id >> 32);
+    if (id == 0 || index >= nodes.size() || !nodes[index].active || nodes[index].generation != generation)
+        return false;
+
+    unlink(index);
+    freeNode(index);
+    count--;
+    return true;
+}
+
+void TimerWheel::advance(uint64_t nowMs) {
+    uint64_t target = nowMs / tickMs;
+    //没有定时器时直接跳过去
+    if (count == 0) {
+        if (current <= target)
+            current = target + 1;
+        return;
+    }
+    while (current <= target) {
+        //第0层转完一圈，从上一层取下一格；上一层也转完一圈就继续往上
+        uint64_t rootIndex = current & (ROOT_SIZE - 1);
+        if (rootIndex == 0) {
+            for (int level = 1; level < NUM_LEVELS; ++level) {
+                cascade(level);
+                if (((current >> (ROOT_BITS + (level - 1) * LEVEL_BITS)) & (LEVEL_SIZE - 1)) != 0)
+                    break;
+            }
+        }
+        runSlot(uint16_t(rootIndex));
+        current++;
+    }
+}
+
+void TimerWheel::catchUp(uint64_t nowMs) {
+    uint64_t target = nowMs / tickMs;
+    uint64_t next = nextTick();
+    if (next != NO_TICK && target >= next) {
+        if (next <= current)
+            return;
+        target = next - 1;
+    }
+    if (current <= target)
+        advance(target * tickMs);
+}
+
+uint64_t TimerWheel::nextTick() const {
+    if (count == 0)
+        return NO_TICK;
+
+    //第0层的格子正好是接下来的ROOT_SIZE个tick
+    uint64_t next = NO_TICK;
+    for (uint64_t tick = current; tick < current + ROOT_SIZE; ++tick) {
+        if (heads[tick & (ROOT_SIZE - 1)] != NIL) {
+            next = tick;
+            break;
+        }
+    }
+    //上层的一格在第0层转到它的时候才分散下来，里面的定时器不会早于这个时刻到期
+    for (int level = 1; level < NUM_LEVELS; ++level) {
+        int shift = ROOT_BITS + (level - 1) * LEVEL_BITS;
+        uint64_t boundary = ((current + (uint64_t(1) << shift) - 1) >> shift) << shift;
+        for (int i = 0; i < LEVEL_SIZE; ++i) {
+            uint64_t tick = boundary + (uint64_t(i) << shift);
+            if (tick >= next)
+                break;
+            if (heads[ROOT_SIZE + (level - 1) * LEVEL_SIZE + ((tick >> shift) & (LEVEL_SIZE - 1))] != NIL) {
+                next = tick;
+                break;
+            }
+        }
+    }
+    return next;
+}
+
+uint32_t TimerWheel::allocNode() {
+    if (freeList != NIL) {
+        uint32_t index = freeList;
+        freeList = nodes[index].next;
+        return index;
+    }
+    nodes.emplace_back();
+    nodes.back().generation = 1;
+    return uint32_t(nodes.size() - 1);
+}
+
+void TimerWheel::freeNode(uint32_t index) {
+    Node& node = nodes[index];
+    node.func = nullptr;
+    node.active = false;
+    node.generation++;
+    if (node.generation == 0)
+        node.generation = 1;    //保证id不为0
+    node.prev = NIL;
+    node.next = freeList;
+    freeList = index;
+}
+
+void TimerWheel::place(uint32_t index) {
+    uint64_t expire = nodes[index].expire;
+    uint64_t delta = expire > current ? expire - current : 0;
+
+    if (delta < ROOT_SIZE) {
+        link(index, uint16_t(expire & (ROOT_SIZE - 1)));
+        return;
+    }
+    for (int level = 1; level < NUM_LEVELS; ++level) {
+        int shift = ROOT_BITS + (level - 1) * LEVEL_BITS;
+        if (delta < (uint64_t(1) << (shift + LEVEL_BITS)) || level == NUM_LEVELS - 1) {
+            uint16_t slot = uint16_t(ROOT_SIZE + (level - 1) * LEVEL_SIZE + ((expire >> shift) & (LEVEL_SIZE - 1)));
+            link(index, slot);
+            return;
+        }
+    }
+}
+
+void TimerWheel::link(uint32_t index, uint16_t slot) {
+    Node& node = nodes[index];
+    node.slot = slot;
+    node.prev = NIL;
+    node.next = heads[slot];
+    if (heads[slot] != NIL)
+        nodes[heads[slot]].prev = index;
+    heads[slot] = index;
+}
+
+void TimerWheel::unlink(uint32_t index) {
+    Node& node = nodes[index];
+    if (node.prev != NIL)
+        nodes[node.prev].next = node.next;
+    else
+        heads[node.slot] = node.next;
+    if (node.next != NIL)
+        nodes[node.next].prev = node.prev;
+    node.prev = node.next = NIL;
+}
+
+void TimerWheel::cascade(int level) {
+    int shift = ROOT_BITS + (level - 1) * LEVEL_BITS;
+    uint16_t slot = uint16_t(ROOT_SIZE + (level - 1) * LEVEL_SIZE + ((current >> shift) & (LEVEL_SIZE - 1)));
+
+    uint32_t index = heads[slot];
+    heads[slot] = NIL;
+    while (index != NIL) {
+        uint32_t next = nodes[index].next;
+        place(index);
+        index = next;
+    }
+}
+
+//先把整格摘下来再逐个执行，回调里添加或取消定时器都不会影响遍历
+void TimerWheel::runSlot(uint16_t slot) {
+    heads[RUNNING_SLOT] = heads[slot];
+    heads[slot] = NIL;
+    if (heads[RUNNING_SLOT] != NIL) {
+        for (uint32_t index = heads[RUNNING_SLOT]; index != NIL; index = nodes[index].next)
+            nodes[index].slot = RUNNING_SLOT;
+    }
+
+    while (heads[RUNNING_SLOT] != NIL) {
+        uint32_t index = heads[RUNNING_SLOT];
+        unlink(index);
+        //没有到期的(只可能来自最高层被截断的超长定时)重新放回去
+        if (nodes[index].expire > current) {
+            place(index);
+            continue;
+        }
+        Callback func = std::move(nodes[index].func);
+        freeNode(index);
+        count--;
+        func();
+    }
+}
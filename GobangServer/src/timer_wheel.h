@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <vector>
+
+
+//分层时间轮，和Linux内核的定时器相同：第0层256格每格一个tick，后面三层各64格，
+//每层一格等于上一层转一圈。添加和取消都是常数时间，每个tick只处理当前的一格，
+//第0层转完一圈时把上一层的一格重新分散到下面。定时器节点放在数组里复用，不为每个定时器单独分配内存。
+//不是线程安全的，只在事件循环线程中使用
+class TimerWheel {
+public:
+    typedef uint64_t TimerId;           //0表示无效
+    typedef std::function<void()> Callback;
+    static const uint64_t NO_TICK = UINT64_MAX;
+
+    explicit TimerWheel(int tickMs);
+
+public:
+    //delayMs之后执行，精度为一个tick
+    TimerId add(int delayMs, Callback func);
+    //取消还没执行的定时器，已经执行过或者无效的id返回false
+    bool cancel(TimerId id);
+    //时间走到nowMs(从构造时开始计算的毫秒数)，执行所有到期的定时器
+    void advance(uint64_t nowMs);
+    //走到nowMs，但不越过下一个要处理的tick，不会执行任何定时器
+    void catchUp(uint64_t nowMs);
+    //下一个可能有定时器到期的tick(上层的格子按分散下来的时刻算)，没有定时器时为NO_TICK
+    uint64_t nextTick() const;
+
+    size_t size() const { return count; }
+    int getTickMs() const { return tickMs; }
+
+private:
+    enum {
+        ROOT_BITS = 8, LEVEL_BITS = 6, NUM_LEVELS = 4,
+        ROOT_SIZE = 1 << ROOT_BITS, LEVEL_SIZE = 1 << LEVEL_BITS,
+        NUM_SLOTS = ROOT_SIZE + (NUM_LEVELS - 1) * LEVEL_SIZE,
+        RUNNING_SLOT = NUM_SLOTS,       //正在执行的那一格先摘到这里
+        MAX_TICKS = (1 << (ROOT_BITS + (NUM_LEVELS - 1) * LEVEL_BITS)) - 1
+    };
+    static const uint32_t NIL = 0xFFFFFFFF;
+
+    struct Node {
+        uint64_t expire = 0;            //到期的tick
+        Callback func;
+        uint32_t prev = NIL;
+        uint32_t next = NIL;
+        uint32_t generation = 0;        //节点复用后旧的id失效
+        uint16_t slot = 0;
+        bool active = false;
+    };
+
+    uint32_t allocNode();
+    void freeNode(uint32_t index);
+    void place(uint32_t index);         //按到期时间放进对应的格子
+    void link(uint32_t index, uint16_t slot);
+    void unlink(uint32_t index);
+    void cascade(int level);            //把上一层当前的一格分散到下面
+    void runSlot(uint16_t slot);
+
+private:
+    int tickMs;
+    uint64_t current = 0;               //下一个要处理的tick
+    size_t count = 0;
+
+    std::vector<Node> nodes;
+    uint32_t freeList = NIL;
+    uint32_t heads[NUM_SLOTS + 1];
+};
@@ -0,0 +1,247 @@
+#include "upgrade.h"
+#include "logger.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include <algorithm>
+
+#include "jsoncpp/json/reader.h"
+#include "jsoncpp/json/writer.h"
+
+#define MAX_FDS_PER_MSG     200         //一条消息能带的fd有上限(SCM_MAX_FD为253)，分批发送
+#define CHANNEL_TIMEOUT_SEC 5           //交接过程中任何一步超过这个时间就放弃
+#define MAX_STATE_LENGTH    (256u << 20)
+
+namespace Upgrade {
+
+
+/***********************
+ * Local functions
+***********************/
+static bool makeAddress(const std::string& path, struct sockaddr_un& addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+        return false;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+static void setTimeouts(SocketFD fd) {
+    struct timeval timeout = { CHANNEL_TIMEOUT_SEC, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+static bool writeAll(SocketFD fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+static bool readAll(SocketFD fd, char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = recv(fd, data, length, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+//每批带一个字节的数据，接收方每次只读一个字节，保证每次recvmsg正好收到一批fd
+static bool sendFds(SocketFD channel, const int* fds, size_t count) {
+    char byte = 'F';
+    struct iovec vec = { &byte, 1 };
+    char control[CMSG_SPACE(sizeof(int) * MAX_FDS_PER_MSG)];
+    memset(control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &vec;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+
+    ssize_t n;
+    do {
+        n = sendmsg(channel, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    return n == 1;
+}
+
+static bool recvFds(SocketFD channel, std::vector<int>& fds) {
+    char byte = 0;
+    struct iovec vec = { &byte, 1 };
+    char control[CMSG_SPACE(sizeof(int) * MAX_FDS_PER_MSG)];
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &vec;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do {
+        n = recvmsg(channel, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n != 1 || (msg.msg_flags & MSG_CTRUNC))
+        return false;
+
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const int* data = (const int*)CMSG_DATA(cmsg);
+        fds.insert(fds.end(), data, data + count);
+    }
+    return true;
+}
+
+
+/***********************
+ * Channel
+***********************/
+SocketFD listenOn(const std::string& path) {
+    struct sockaddr_un addr;
+    if (!makeAddress(path, addr)) {
+        LOG_ERROR("Invalid upgrade socket path: %s", path.c_str());
+        return -1;
+    }
+
+    SocketFD fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    unlink(path.c_str());
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(fd, 1) == -1) {
+        LOG_ERROR("upgrade socket bind/listen error: %s(errno: %d)", strerror(errno), errno);
+        closeSocket(fd);
+        return -1;
+    }
+    return fd;
+}
+
+SocketFD connectTo(const std::string& path) {
+    struct sockaddr_un addr;
+    if (!makeAddress(path, addr))
+        return -1;
+
+    SocketFD fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        closeSocket(fd);
+        return -1;
+    }
+    setTimeouts(fd);
+    return fd;
+}
+
+//|json长度|fd个数|json|，之后是若干批fd
+bool sendState(SocketFD channel, const Json::Value& state, const std::vector<int>& fds) {
+    setTimeouts(channel);
+    std::string body = Json::FastWriter().write(state);
+    uint32_t header[2] = { htonl(uint32_t(body.size())), htonl(uint32_t(fds.size())) };
+    if (!writeAll(channel, (const char*)header, sizeof(header)) ||
+            !writeAll(channel, body.data(), body.size()))
+        return false;
+
+    for (size_t i = 0; i < fds.size(); i += MAX_FDS_PER_MSG) {
+        size_t count = std::min(fds.size() - i, size_t(MAX_FDS_PER_MSG));
+        if (!sendFds(channel, &fds[i], count))
+            return false;
+    }
+    return true;
+}
+
+bool recvState(SocketFD channel, Json::Value& state, std::vector<int>& fds) {
+    uint32_t header[2];
+    if (!readAll(channel, (char*)header, sizeof(header)))
+        return false;
+    uint32_t length = ntohl(header[0]);
+    uint32_t count = ntohl(header[1]);
+    if (length > MAX_STATE_LENGTH)
+        return false;
+
+    std::string body(length, '\0');
+    if (length > 0 && !readAll(channel, &body[0], length))
+        return false;
+    if (!Json::Reader().parse(body, state))
+        return false;
+
+    fds.clear();
+    while (fds.size() < count) {
+        if (!recvFds(channel, fds))
+            return false;
+    }
+    return fds.size() == count;
+}
+
+bool sendAck(SocketFD channel) {
+    return writeAll(channel, "K", 1);
+}
+
+bool waitAck(SocketFD channel) {
+    char byte = 0;
+    return readAll(channel, &byte, 1) && byte == 'K';
+}
+
+
+/***********************
+ * Hex
+***********************/
+std::string toHex(const std::string& bytes) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(bytes.size() * 2);
+    for (unsigned char c : bytes) {
+        hex.push_back(digits[c >> 4]);
+        hex.push_back(digits[c & 0x0f]);
+    }
+    return hex;
+}
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+std::string fromHex(const std::string& hex) {
+    std::string bytes;
+    bytes.reserve(hex.size() / 2);
+    for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+        int high = hexValue(hex[i]), low = hexValue(hex[i + 1]);
+        if (high < 0 || low < 0)
+            break;
+        bytes.push_back(char(high << 4 | low));
+    }
+    return bytes;
+}
+
+
+}; // namespace Upgrade
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "socket_func.h"
+#include "jsoncpp/json/json.h"
+
+#include <string>
+#include <vector>
+
+
+//热升级：旧进程在一个Unix域socket上等待新进程，新进程连上后，旧进程停下事件循环，
+//把监听socket和所有客户端连接用SCM_RIGHTS传过去，同时发送json格式的状态快照。
+//新进程恢复完后回一个字节确认，旧进程收到确认才关闭自己手里的fd并退出，客户端感觉不到重启
+namespace Upgrade {
+
+SocketFD listenOn(const std::string& path);         //旧进程：监听path，非阻塞；原来的socket文件会被删除
+SocketFD connectTo(const std::string& path);        //新进程：连接旧进程，没有旧进程在运行时返回-1
+
+//快照中用旧进程的fd编号引用连接，fds按同样的顺序发送，对方收到的是新的编号
+bool sendState(SocketFD channel, const Json::Value& state, const std::vector<int>& fds);
+bool recvState(SocketFD channel, Json::Value& state, std::vector<int>& fds);
+
+bool sendAck(SocketFD channel);
+bool waitAck(SocketFD channel);
+
+//连接上没写完和没解析的字节是二进制数据，放进json前转成十六进制
+std::string toHex(const std::string& bytes);
+std::string fromHex(const std::string& hex);
+
+}; // namespace Upgrade
@@ -0,0 +1,42 @@
+#include "win_detector.h"
+
+#include <string.h>
+
+
+static const int dirs[] = {
+    BitBoard::DIR_ROW, BitBoard::DIR_COL, BitBoard::DIR_DIAG, BitBoard::DIR_ANTI
+};
+
+
+void WinDetector::clear() {
+    memset(runs, 0, sizeof(runs));
+}
+
+//每行的第16格空着，所以左右越界都会落在空格上，只需要检查上下越界
+bool WinDetector::sameColor(const BitBoard& board, int index, ChessType type) {
+    if (index < 0 || index >= NUM_CELLS)
+        return false;
+    int row = index / BitBoard::STRIDE, col = index % BitBoard::STRIDE;
+    return col < BitBoard::SIZE && board.get(row, col) == type;
+}
+
+int WinDetector::place(const BitBoard& board, int row, int col, ChessType type) {
+    int index = row * BitBoard::STRIDE + col;
+    int longest = 1;
+
+    for (int i = 0; i < NUM_DIRS; ++i) {
+        int step = dirs[i];
+        uint8_t* run = runs[i];
+
+        //新棋子原来是空格，所以相邻的同色棋子一定是某一段的端点
+        int before = sameColor(board, index - step, type) ? run[index - step] : 0;
+        int after = sameColor(board, index + step, type) ? run[index + step] : 0;
+
+        int length = before + 1 + after;
+        run[index - before * step] = uint8_t(length);
+        run[index + after * step] = uint8_t(length);
+        if (length > longest)
+            longest = length;
+    }
+    return longest;
+}
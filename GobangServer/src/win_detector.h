@@ -0,0 +1,29 @@
+#pragma once
+
+#include "base.h"
+#include "bitboard.h"
+
+#include <stdint.h>
+
+
+//增量判断连五：每个方向上，同色连续的一段棋子只在两个端点记录这一段的长度。
+//新落下的棋子只需要读相邻两格的端点值就能得到合并后的长度，再把新长度写到新的两个端点，
+//每步落子是常数时间，和棋盘上已有的棋子数无关
+class WinDetector {
+public:
+    WinDetector() { clear(); }
+
+public:
+    void clear();
+
+    //board中(row, col)已经放上了type，返回经过这一格的最长同色连线的长度
+    int place(const BitBoard& board, int row, int col, ChessType type);
+
+private:
+    enum { NUM_CELLS = BitBoard::SIZE * BitBoard::STRIDE, NUM_DIRS = 4 };
+
+    static bool sameColor(const BitBoard& board, int index, ChessType type);
+
+private:
+    uint8_t runs[NUM_DIRS][NUM_CELLS];  //下标同BitBoard的位下标，只有端点上的值有效
+};
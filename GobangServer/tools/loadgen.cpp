@@ -0,0 +1,591 @@
+//压测工具：在一个事件循环里模拟N个房间的玩家和观众，通过本机回环连接gobang_server，
+//按照正常的协议建房、加入、观战、准备、轮流落子和聊天，统计吞吐量、落子往返延迟、错误和断线
+//
+//  gobang_loadgen --rooms 200 --watchers 4 --think-ms 50 --duration 30
+//
+//观众可以连到中继上，多个中继时轮流分配：
+//  gobang_server --port 6666 &
+//  gobang_server --port 6667 --relay 127.0.0.1:6666 &
+//  gobang_server --port 6668 --relay 127.0.0.1:6667 &
+//  gobang_loadgen --rooms 50 --watchers 100 --watch-ports 6667,6668
+
+#include "event_loop.h"
+#include "frame.h"
+#include "frame_decoder.h"
+
+#include "jsoncpp/json/json.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 6666;
+    int rooms = 100;                //房间数，每个房间两名玩家
+    int watchers = 2;               //每个房间的观众数
+    int thinkMs = 100;              //收到对手落子后多久再落子，精度为事件循环的10ms
+    int chatEvery = 10;             //每隔多少步发一条聊天，0表示不聊天
+    int duration = 30;              //秒
+    bool binary = false;            //玩家使用二进制分帧，落子为2字节的消息
+    std::vector<int> watchPorts;    //观众连接的端口(比如中继)，为空时和玩家连同一个端口
+};
+
+struct Stats {
+    uint64_t connections = 0;
+    uint64_t framesIn = 0;
+    uint64_t framesOut = 0;
+    uint64_t bytesIn = 0;
+    uint64_t bytesOut = 0;
+    uint64_t moves = 0;
+    uint64_t games = 0;
+    uint64_t chats = 0;
+    uint64_t watcherMoves = 0;      //观众收到的落子
+    uint64_t errors = 0;            //连接失败、错误的响应、无法解析的消息
+    uint64_t disconnects = 0;       //服务器主动断开
+    std::vector<uint32_t> latencies;    //落子往返延迟，微秒
+};
+
+class LoadGen;
+struct SimRoom;
+
+//一个模拟的客户端连接
+struct Client {
+    enum Role { HOST, GUEST, WATCHER };
+
+    LoadGen* gen = nullptr;
+    SimRoom* room = nullptr;
+    Role role = WATCHER;
+    SocketFD fd = -1;
+    FrameDecoder decoder;
+    std::string outbuf;             //socket写不进去的部分，可写时继续写
+    bool binary = false;
+    bool connected = false;
+    bool closed = false;
+
+    void send(uint8_t kind, const std::string& body);
+    void sendJson(const Json::Value& root);
+    void flush();
+};
+
+//一个模拟的房间：房主执黑，加入者执白，双方轮流在随机的空位落子直到分出胜负，然后重新准备
+struct SimRoom {
+    int index = 0;
+    int id = -1;
+    std::unique_ptr<Client> host;
+    std::unique_ptr<Client> guest;
+    std::vector< std::unique_ptr<Client> > watchers;
+
+    bool running = false;
+    int game = 0;                   //第几局，上一局留下的定时任务据此作废
+    bool occupied[15 * 15];
+    int numMoves = 0;
+    Clock::time_point sentAt;       //最后一步发出的时间
+    bool waitingMove = false;       //最后一步还没被对手收到
+};
+
+
+class LoadGen {
+public:
+    explicit LoadGen(const Options& opts) : opts(opts), rng(std::random_device()()) { }
+
+    int run();
+
+    void onFrame(Client* client, const FrameView& frame);
+    void onClosed(Client* client);
+    Stats& getStats() { return stats; }
+
+private:
+    std::unique_ptr<Client> connect(SimRoom* room, Client::Role role, int port);
+    void startRoom(SimRoom* room);
+    void onJson(Client* client, const Json::Value& root);
+    void onMove(Client* client, int row, int col);
+    void prepare(SimRoom* room);
+    void makeMove(SimRoom* room, Client* mover, int game);
+
+    void after(int ms, std::function<void()> func) { loop.runAfter(ms, std::move(func)); }
+    void onTick();
+    void report(bool final);
+
+private:
+    Options opts;
+    EventLoop loop;
+    Stats stats;
+    std::mt19937 rng;
+    std::vector< std::unique_ptr<SimRoom> > rooms;
+
+    Clock::time_point startTime;
+    Clock::time_point lastReport;
+    uint64_t lastMoves = 0;
+};
+
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void handleSigint(int) {
+    interrupted = 1;
+}
+
+
+/**************************************
+ * Client
+**************************************/
+void Client::send(uint8_t kind, const std::string& body) {
+    if (closed)
+        return;
+    char header[MAX_HEADER_LENGTH];
+    size_t headerLength = encodeFrameHeader(header, binary ? FRAMING_BINARY : FRAMING_TEXT, kind, body.size());
+    if (headerLength == 0)
+        return;
+
+    outbuf.append(header, headerLength);
+    outbuf.append(body);
+    gen->getStats().framesOut++;
+    gen->getStats().bytesOut += body.size();
+    flush();
+}
+
+void Client::sendJson(const Json::Value& root) {
+    send(FRAME_JSON, Json::FastWriter().write(root));
+}
+
+void Client::flush() {
+    while (!outbuf.empty() && !closed) {
+        ssize_t n = ::send(fd, outbuf.data(), outbuf.size(), MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOTCONN))
+            return;         //等EPOLLOUT
+        if (n <= 0) {
+            gen->onClosed(this);
+            return;
+        }
+        outbuf.erase(0, n);
+    }
+}
+
+
+/**************************************
+ * LoadGen
+**************************************/
+std::unique_ptr<Client> LoadGen::connect(SimRoom* room, Client::Role role, int port) {
+    std::unique_ptr<Client> client(new Client());
+    client->gen = this;
+    client->room = room;
+    client->role = role;
+    client->binary = false;     //二进制分帧在服务器回应建房/加入之后才生效
+
+    client->fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, opts.host.c_str(), &addr.sin_addr);
+
+    //非阻塞连接，连接建立之前发出的消息先留在outbuf里，可写时再发
+    if (client->fd >= 0) {
+        fcntl(client->fd, F_SETFL, fcntl(client->fd, F_GETFL, 0) | O_NONBLOCK);
+        int on = 1;
+        setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    if (client->fd < 0 || (::connect(client->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS)) {
+        fprintf(stderr, "connect error: %s(errno: %d)\n", strerror(errno), errno);
+        if (client->fd >= 0)
+            close(client->fd);
+        client->closed = true;
+        stats.errors++;
+        return client;
+    }
+
+    Client* c = client.get();
+    loop.addFd(c->fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, [this, c](uint32_t events){
+        //第一次可写说明连接已经建立
+        if (!c->connected && (events & EPOLLOUT) && !(events & EPOLLERR)) {
+            c->connected = true;
+            stats.connections++;
+        }
+        if (events & EPOLLOUT)
+            c->flush();
+        if (!(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) || c->closed)
+            return;
+
+        int ret = FrameDecoder::READ_FULL;
+        while (ret == FrameDecoder::READ_FULL && !c->closed) {
+            ret = c->decoder.readFrom(c->fd);
+            FrameView frame;
+            int parsed;
+            while (!c->closed && (parsed = c->decoder.next(frame)) == FrameDecoder::FRAME_OK)
+                onFrame(c, frame);
+            if (parsed == FrameDecoder::FRAME_BAD) {
+                stats.errors++;
+                ret = FrameDecoder::READ_CLOSED;
+            }
+        }
+        if (ret == FrameDecoder::READ_CLOSED && !c->closed)
+            onClosed(c);
+    });
+    return client;
+}
+
+void LoadGen::onClosed(Client* client) {
+    if (client->closed)
+        return;
+    client->closed = true;
+    if (client->connected)
+        stats.disconnects++;
+    else
+        stats.errors++;         //没连上
+    loop.removeFd(client->fd);
+    close(client->fd);
+
+    //一方玩家断了，这个房间就不会再有落子
+    if (client->role != Client::WATCHER)
+        client->room->running = false;
+}
+
+void LoadGen::startRoom(SimRoom* room) {
+    room->host = connect(room, Client::HOST, opts.port);
+    Json::Value root;
+    root["type"] = "command";
+    root["cmd"] = "create_room";
+    root["room_name"] = "load" + std::to_string(room->index);
+    root["player_name"] = "h" + std::to_string(room->index);
+    if (opts.binary)
+        root["framing"] = "binary";
+    room->host->sendJson(root);
+}
+
+void LoadGen::onFrame(Client* client, const FrameView& frame) {
+    stats.framesIn++;
+    stats.bytesIn += frame.length;
+
+    if (frame.kind == FRAME_MOVE) {
+        int row, col, chessType;
+        if (decodeMove(frame.data, frame.length, row, col, chessType))
+            onMove(client, row, col);
+        else
+            stats.errors++;
+        return;
+    }
+
+    Json::Value root;
+    Json::Reader reader;
+    if (!reader.parse(frame.data, frame.data + frame.length, root)) {
+        stats.errors++;
+        return;
+    }
+    onJson(client, root);
+}
+
+void LoadGen::onJson(Client* client, const Json::Value& root) {
+    SimRoom* room = client->room;
+    std::string type = root["type"].asString();
+
+    if (type == "response") {
+        std::string resCmd = root["res_cmd"].asString();
+        if (root["status"].asInt() != 0) {
+            //对手还没加入时准备会失败，其他错误都计数
+            if (resCmd != "prepare")
+                stats.errors++;
+            return;
+        }
+
+        if (resCmd == "create_room") {
+            client->binary = opts.binary;
+            room->id = root["room_id"].asInt();
+            room->guest = connect(room, Client::GUEST, opts.port);
+            Json::Value join;
+            join["type"] = "command";
+            join["cmd"] = "join_room";
+            join["room_id"] = room->id;
+            join["player_name"] = "g" + std::to_string(room->index);
+            if (opts.binary)
+                join["framing"] = "binary";
+            room->guest->sendJson(join);
+        }
+        else if (resCmd == "join_room") {
+            client->binary = opts.binary;
+            for (int i = 0; i < opts.watchers; ++i) {
+                int port = opts.watchPorts.empty() ? opts.port :
+                    opts.watchPorts[size_t(room->index * opts.watchers + i) % opts.watchPorts.size()];
+                room->watchers.push_back(connect(room, Client::WATCHER, port));
+                Json::Value watch;
+                watch["type"] = "command";
+                watch["cmd"] = "watch_room";
+                watch["room_id"] = room->id;
+                watch["player_name"] = "w" + std::to_string(room->index) + "_" + std::to_string(i);
+                room->watchers.back()->sendJson(watch);
+            }
+            prepare(room);
+        }
+        return;
+    }
+
+    if (type == "notify" && client->role == Client::WATCHER && root["sub_type"].asString() == "new_piece")
+        stats.watcherMoves++;
+    if (type != "notify" || client->role == Client::WATCHER)
+        return;
+
+    std::string subType = root["sub_type"].asString();
+    //两名玩家都会收到game_start，只在先手的房主这里开始新的一局
+    if (subType == "game_start" && client->role == Client::HOST) {
+        room->running = true;
+        room->game++;
+        room->numMoves = 0;
+        room->waitingMove = false;
+        std::fill(room->occupied, room->occupied + 15 * 15, false);
+        after(opts.thinkMs, [this, room, game = room->game](){ makeMove(room, room->host.get(), game); });
+    }
+    else if (subType == "new_piece") {
+        onMove(client, root["row"].asInt(), root["col"].asInt());
+    }
+    else if (subType == "game_over") {
+        //两名玩家都会收到，只在房主这里计一次
+        room->running = false;
+        if (client->role == Client::HOST) {
+            stats.games++;
+            after(opts.thinkMs, [this, room](){ prepare(room); });
+        }
+    }
+}
+
+//玩家收到对手的落子：记录往返延迟，思考一会儿后落子
+void LoadGen::onMove(Client* client, int row, int col) {
+    if (client->role == Client::WATCHER) {
+        stats.watcherMoves++;
+        return;
+    }
+
+    SimRoom* room = client->room;
+    if (room->waitingMove) {
+        room->waitingMove = false;
+        stats.latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                    Clock::now() - room->sentAt).count());
+    }
+    if (row >= 0 && row < 15 && col >= 0 && col < 15)
+        room->occupied[row * 15 + col] = true;
+
+    after(opts.thinkMs, [this, room, client, game = room->game](){ makeMove(room, client, game); });
+}
+
+void LoadGen::prepare(SimRoom* room) {
+    Json::Value root;
+    root["type"] = "command";
+    root["cmd"] = "prepare";
+    root["player_name"] = "h" + std::to_string(room->index);
+    room->host->sendJson(root);
+    root["player_name"] = "g" + std::to_string(room->index);
+    room->guest->sendJson(root);
+}
+
+void LoadGen::makeMove(SimRoom* room, Client* mover, int game) {
+    if (!room->running || room->game != game || mover->closed)
+        return;
+
+    //在随机的空位落子，棋盘下满前总会有一方连五或者和棋
+    int free = 15 * 15 - room->numMoves;
+    if (free <= 0)
+        return;
+    int pick = std::uniform_int_distribution<int>(0, free - 1)(rng);
+    int cell = 0;
+    for (; cell < 15 * 15; ++cell) {
+        if (!room->occupied[cell] && pick-- == 0)
+            break;
+    }
+    room->occupied[cell] = true;
+    room->numMoves++;
+
+    int row = cell / 15, col = cell % 15;
+    int chessType = mover->role == Client::HOST ? -1 : 1;
+    room->sentAt = Clock::now();
+    room->waitingMove = true;
+    stats.moves++;
+
+    if (mover->binary) {
+        char body[MOVE_BODY_LENGTH];
+        encodeMove(body, row, col, chessType);
+        mover->send(FRAME_MOVE, std::string(body, MOVE_BODY_LENGTH));
+    }
+    else {
+        Json::Value root;
+        root["type"] = "notify";
+        root["sub_type"] = "new_piece";
+        root["row"] = row;
+        root["col"] = col;
+        root["chess_type"] = chessType;
+        mover->sendJson(root);
+    }
+
+    if (opts.chatEvery > 0 && room->numMoves % opts.chatEvery == 0) {
+        Json::Value chat;
+        chat["type"] = "chat";
+        chat["player_name"] = mover->role == Client::HOST ? "h" : "g";
+        chat["message"] = "move " + std::to_string(room->numMoves);
+        mover->sendJson(chat);
+        stats.chats++;
+    }
+}
+
+//每100ms检查一次是否该输出统计或者结束
+void LoadGen::onTick() {
+    Clock::time_point now = Clock::now();
+    after(100, [this](){ onTick(); });
+
+    if (now - lastReport >= std::chrono::seconds(1))
+        report(false);
+    if (interrupted || now - startTime >= std::chrono::seconds(opts.duration))
+        loop.quit();
+}
+
+static uint32_t percentile(const std::vector<uint32_t>& sorted, double p) {
+    if (sorted.empty())
+        return 0;
+    size_t index = std::min(sorted.size() - 1, size_t(p * sorted.size()));
+    return sorted[index];
+}
+
+void LoadGen::report(bool final) {
+    Clock::time_point now = Clock::now();
+    double elapsed = std::chrono::duration<double>(now - startTime).count();
+
+    if (!final) {
+        double interval = std::chrono::duration<double>(now - lastReport).count();
+        printf("[%5.1fs] conns %llu  moves/s %.0f  frames in %llu out %llu  errors %llu  disconnects %llu\n",
+                elapsed, (unsigned long long)stats.connections, (stats.moves - lastMoves) / interval,
+                (unsigned long long)stats.framesIn, (unsigned long long)stats.framesOut,
+                (unsigned long long)stats.errors, (unsigned long long)stats.disconnects);
+        fflush(stdout);
+        lastReport = now;
+        lastMoves = stats.moves;
+        return;
+    }
+
+    //最后一步发出超过5秒还没被对手收到的房间，服务器可能拒绝了这一步或者卡住了
+    int stalled = 0;
+    for (auto& room : rooms) {
+        if (room->running && room->waitingMove && now - room->sentAt > std::chrono::seconds(5))
+            stalled++;
+    }
+
+    std::vector<uint32_t> sorted = stats.latencies;
+    std::sort(sorted.begin(), sorted.end());
+
+    printf("\n");
+    printf("rooms          %d (%d watchers each, %s framing)\n", opts.rooms, opts.watchers,
+            opts.binary ? "binary" : "text");
+    printf("duration       %.1fs, think time %dms\n", elapsed, opts.thinkMs);
+    printf("connections    %llu\n", (unsigned long long)stats.connections);
+    printf("games          %llu\n", (unsigned long long)stats.games);
+    printf("moves          %llu (%.0f/s)\n", (unsigned long long)stats.moves, stats.moves / elapsed);
+    printf("chats          %llu\n", (unsigned long long)stats.chats);
+    printf("watcher moves  %llu\n", (unsigned long long)stats.watcherMoves);
+    printf("frames in      %llu (%.0f/s), %llu bytes\n", (unsigned long long)stats.framesIn,
+            stats.framesIn / elapsed, (unsigned long long)stats.bytesIn);
+    printf("frames out     %llu (%.0f/s), %llu bytes\n", (unsigned long long)stats.framesOut,
+            stats.framesOut / elapsed, (unsigned long long)stats.bytesOut);
+    printf("move rtt (us)  p50 %u  p99 %u  p999 %u  max %u  (%zu samples)\n",
+            percentile(sorted, 0.5), percentile(sorted, 0.99), percentile(sorted, 0.999),
+            sorted.empty() ? 0 : sorted.back(), sorted.size());
+    printf("errors         %llu\n", (unsigned long long)stats.errors);
+    printf("disconnects    %llu\n", (unsigned long long)stats.disconnects);
+    printf("stalled rooms  %d\n", stalled);
+}
+
+int LoadGen::run() {
+    after(100, [this](){ onTick(); });
+
+    startTime = lastReport = Clock::now();
+    for (int i = 0; i < opts.rooms; ++i) {
+        rooms.emplace_back(new SimRoom());
+        rooms.back()->index = i;
+        startRoom(rooms.back().get());
+    }
+
+    loop.loop();
+    report(true);
+
+    for (auto& room : rooms) {
+        for (Client* client : { room->host.get(), room->guest.get() }) {
+            if (client && !client->closed)
+                close(client->fd);
+        }
+        for (auto& watcher : room->watchers) {
+            if (!watcher->closed)
+                close(watcher->fd);
+        }
+    }
+    return stats.errors == 0 ? 0 : 1;
+}
+
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --host <addr>       server address (127.0.0.1)\n"
+            "  --port <port>       server port (6666)\n"
+            "  --rooms <n>         rooms to create, two players each (100)\n"
+            "  --watchers <n>      watchers per room (2)\n"
+            "  --think-ms <ms>     delay before answering a move (100)\n"
+            "  --chat-every <n>    send a chat message every n moves, 0 disables (10)\n"
+            "  --duration <s>      seconds to run (30)\n"
+            "  --binary            negotiate binary framing for players\n"
+            "  --watch-ports <ps>  comma separated ports for watchers, e.g. relays (--port)\n", prog);
+}
+
+int main(int argc, char** argv) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--binary")
+            opts.binary = true;
+        else if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 2;
+        }
+        else if (arg == "--host")
+            opts.host = argv[++i];
+        else if (arg == "--port")
+            opts.port = atoi(argv[++i]);
+        else if (arg == "--rooms")
+            opts.rooms = atoi(argv[++i]);
+        else if (arg == "--watchers")
+            opts.watchers = atoi(argv[++i]);
+        else if (arg == "--think-ms")
+            opts.thinkMs = atoi(argv[++i]);
+        else if (arg == "--chat-every")
+            opts.chatEvery = atoi(argv[++i]);
+        else if (arg == "--duration")
+            opts.duration = atoi(argv[++i]);
+        else if (arg == "--watch-ports") {
+            for (char* p = strtok(argv[++i], ","); p; p = strtok(NULL, ","))
+                opts.watchPorts.push_back(atoi(p));
+        }
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    signal(SIGINT, handleSigint);
+    signal(SIGPIPE, SIG_IGN);
+
+    LoadGen gen(opts);
+    return gen.run();
+}
@@ -20,3 +20,39 @@ target("gobang_server")
 
     add_mflags("-g", "-O2", "-DDEBUG")
 
+
+-- 压测工具，用法见tools/loadgen.cpp
+target("gobang_loadgen")
+    set_kind("binary")
+    set_languages("c99", "cxx14")
+
+    add_includedirs("src", "src/jsoncpp")
+
+    add_files("tools/loadgen.cpp")
+    add_files("src/event_loop.cpp", "src/timer_wheel.cpp", "src/frame.cpp", "src/frame_decoder.cpp", "src/logger.cpp")
+    add_files("src/jsoncpp/*.cpp")
+
+    add_links("pthread")
+
+    set_targetdir("$(projectdir)")
+    set_objectdir("build/objs/loadgen")
+
+    add_mflags("-g", "-O2")
+
+-- 基准测试，需要安装Google Benchmark，结果默认写到bench_results.json
+target("gobang_bench")
+    set_kind("binary")
+    set_languages("c99", "cxx14")
+
+    add_includedirs("src", "src/jsoncpp")
+
+    add_files("bench/*.cpp")
+    add_files("src/*.cpp|main.cpp")
+    add_files("src/jsoncpp/*.cpp")
+
+    add_links("benchmark", "pthread")
+
+    set_targetdir("$(projectdir)")
+    set_objectdir("build/objs/bench")
+
+    add_mflags("-g", "-O2")